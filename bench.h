@@ -0,0 +1,672 @@
+#if !defined(BENCH_H)
+#define BENCH_H
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+#include <cpuid.h>
+#include <chrono>
+#include <ctime>
+#include <thread>
+
+#ifndef GIT_REV
+#define GIT_REV "unknown"
+#endif
+
+/*
+ * Helpers shared by the benchmark binaries (local, client).
+ */
+
+enum OutputFormat {
+    FmtText = 0,
+    FmtCsv,
+    FmtJson,
+};
+
+/*
+ * Parse a size like "64", "4k", "2m" or "1g" into bytes.
+ */
+static inline uint64_t parse_size(const char *s)
+{
+    char *end = nullptr;
+    uint64_t v = strtoull(s, &end, 10);
+    if (end != nullptr) {
+        switch (*end) {
+        case 'k': case 'K': v <<= 10; break;
+        case 'm': case 'M': v <<= 20; break;
+        case 'g': case 'G': v <<= 30; break;
+        default: break;
+        }
+    }
+    return v;
+}
+
+/*
+ * Parse a rate like "500", "200k" or "1.5m" (decimal multipliers).
+ */
+static inline double parse_rate(const char *s)
+{
+    char *end = nullptr;
+    double v = strtod(s, &end);
+    if (end != nullptr) {
+        switch (*end) {
+        case 'k': case 'K': v *= 1e3; break;
+        case 'm': case 'M': v *= 1e6; break;
+        case 'g': case 'G': v *= 1e9; break;
+        default: break;
+        }
+    }
+    return v;
+}
+
+static inline OutputFormat parse_format(const char *s)
+{
+    if (strcmp(s, "csv") == 0)
+        return FmtCsv;
+    if (strcmp(s, "json") == 0)
+        return FmtJson;
+    if (strcmp(s, "text") != 0)
+        fprintf(stderr, "unknown output format %s, fall back to text\n", s);
+    return FmtText;
+}
+
+inline void bind_core(uint16_t core)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+/*
+ * Thread-count x granularity sweep.
+ * Threads go 1..MaxThreads, granularities double from SweepMinGranularity up
+ * to MaxGranularity. Each point is measured by the caller-provided run_point,
+ * which returns the bandwidth in GB/s.
+ */
+static const uint32_t SweepMinGranularity = 64;
+static const int SweepWarmupSecs = 1;
+static const int SweepMeasureSecs = 3;
+
+struct SweepMatrix {
+    std::vector<int> threads;
+    std::vector<uint32_t> grans;
+    std::vector<std::vector<double>> gbps;     // [threads][grans]
+};
+
+static inline SweepMatrix run_sweep(int max_threads, uint32_t max_gran,
+                                    std::function<double(int, uint32_t)> run_point)
+{
+    SweepMatrix m;
+    for (int t = 1; t <= max_threads; ++t)
+        m.threads.push_back(t);
+    for (uint32_t g = SweepMinGranularity; g <= max_gran; g <<= 1)
+        m.grans.push_back(g);
+
+    for (int t : m.threads) {
+        m.gbps.emplace_back();
+        for (uint32_t g : m.grans) {
+            double v = run_point(t, g);
+            fprintf(stderr, "sweep: %d threads, %u B -> %.3lf GB/s\n", t, g, v);
+            m.gbps.back().push_back(v);
+        }
+    }
+    return m;
+}
+
+static inline void print_sweep(const SweepMatrix &m, OutputFormat fmt)
+{
+    if (fmt == FmtJson) {
+        printf("{\"threads\": [");
+        for (size_t i = 0; i < m.threads.size(); ++i)
+            printf("%s%d", i ? ", " : "", m.threads[i]);
+        printf("], \"granularity\": [");
+        for (size_t j = 0; j < m.grans.size(); ++j)
+            printf("%s%u", j ? ", " : "", m.grans[j]);
+        printf("], \"gbps\": [");
+        for (size_t i = 0; i < m.threads.size(); ++i) {
+            printf("%s[", i ? ", " : "");
+            for (size_t j = 0; j < m.grans.size(); ++j)
+                printf("%s%.3lf", j ? ", " : "", m.gbps[i][j]);
+            printf("]");
+        }
+        printf("]}\n");
+        return;
+    }
+
+    // CSV (also used for text): one row per thread count
+    printf("threads");
+    for (uint32_t g : m.grans)
+        printf(",%u", g);
+    printf("\n");
+    for (size_t i = 0; i < m.threads.size(); ++i) {
+        printf("%d", m.threads[i]);
+        for (size_t j = 0; j < m.grans.size(); ++j)
+            printf(",%.3lf", m.gbps[i][j]);
+        printf("\n");
+    }
+}
+
+/*
+ * TSC helpers for cheap per-op timestamps.
+ */
+static inline uint64_t rdtsc() { return __rdtsc(); }
+
+static inline double tsc_per_ns()
+{
+    static double ratio = 0;
+    if (ratio == 0) {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto t1 = std::chrono::steady_clock::now();
+        uint64_t c1 = rdtsc();
+        ratio = (c1 - c0) / (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    }
+    return ratio;
+}
+
+/*
+ * Log-linear latency histogram (in ns), 32 sub-buckets per power of two,
+ * so every percentile is within ~3% of the true value.
+ */
+struct LatHist {
+    static const int SubBits = 5;
+    static const int NBuckets = (64 - SubBits + 1) << SubBits;
+
+    uint64_t cnt[NBuckets] = {0};
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    static int index(uint64_t v)
+    {
+        if (v < (1u << SubBits))
+            return (int)v;
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SubBits;
+        return ((shift + 1) << SubBits) + (int)((v >> shift) & ((1u << SubBits) - 1));
+    }
+
+    static uint64_t value(int idx)
+    {
+        if (idx < (1 << SubBits))
+            return idx;
+        int shift = (idx >> SubBits) - 1;
+        uint64_t sub = idx & ((1 << SubBits) - 1);
+        return ((1ull << SubBits) | sub) << shift;
+    }
+
+    void add(uint64_t ns)
+    {
+        cnt[index(ns)]++;
+        total++;
+        if (ns > max)
+            max = ns;
+    }
+
+    void merge(const LatHist &o)
+    {
+        for (int i = 0; i < NBuckets; ++i)
+            cnt[i] += o.cnt[i];
+        total += o.total;
+        if (o.max > max)
+            max = o.max;
+    }
+
+    void reset() { *this = LatHist(); }
+
+    uint64_t percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t target = (uint64_t)(p * total);
+        if (target >= total)
+            target = total - 1;
+        uint64_t acc = 0;
+        for (int i = 0; i < NBuckets; ++i) {
+            acc += cnt[i];
+            if (acc > target)
+                return value(i);
+        }
+        return max;
+    }
+};
+
+/*
+ * A flat key/value result record, printed as a text line, a CSV row or a JSON
+ * object. CSV prints a header whenever the set of columns changes.
+ */
+class Record {
+    struct Field {
+        std::string key;
+        std::string val;
+        bool quoted;
+    };
+    std::vector<Field> fields;
+
+public:
+    Record &add(const char *k, const std::string &v)
+    {
+        fields.push_back({k, v, true});
+        return *this;
+    }
+
+    Record &add(const char *k, const char *v) { return add(k, std::string(v)); }
+
+    Record &add(const char *k, uint64_t v)
+    {
+        fields.push_back({k, std::to_string(v), false});
+        return *this;
+    }
+
+    Record &add(const char *k, int v) { return add(k, (uint64_t)(int64_t)v); }
+    Record &add(const char *k, uint32_t v) { return add(k, (uint64_t)v); }
+
+    Record &add(const char *k, double v, int prec = 3)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*lf", prec, v);
+        fields.push_back({k, buf, false});
+        return *this;
+    }
+
+    void print(OutputFormat fmt, FILE *out = stdout) const
+    {
+        static std::string last_csv_header;
+
+        switch (fmt) {
+        case FmtJson:
+            fprintf(out, "{");
+            for (size_t i = 0; i < fields.size(); ++i) {
+                fprintf(out, "%s\"%s\": ", i ? ", " : "", fields[i].key.c_str());
+                if (fields[i].quoted)
+                    fprintf(out, "\"%s\"", escape(fields[i].val, '\\').c_str());
+                else
+                    fprintf(out, "%s", fields[i].val.c_str());
+            }
+            fprintf(out, "}\n");
+            break;
+        case FmtCsv: {
+            std::string header;
+            for (size_t i = 0; i < fields.size(); ++i)
+                header += (i ? "," : "") + fields[i].key;
+            if (header != last_csv_header) {
+                fprintf(out, "%s\n", header.c_str());
+                last_csv_header = header;
+            }
+            for (size_t i = 0; i < fields.size(); ++i) {
+                if (fields[i].quoted)
+                    fprintf(out, "%s\"%s\"", i ? "," : "", escape(fields[i].val, '"').c_str());
+                else
+                    fprintf(out, "%s%s", i ? "," : "", fields[i].val.c_str());
+            }
+            fprintf(out, "\n");
+            break;
+        }
+        default:
+            for (size_t i = 0; i < fields.size(); ++i)
+                fprintf(out, "%s%s=%s", i ? " " : "", fields[i].key.c_str(), fields[i].val.c_str());
+            fprintf(out, "\n");
+            break;
+        }
+        fflush(out);
+    }
+
+private:
+    // quotes are escaped as \" in JSON and as "" in CSV
+    static std::string escape(const std::string &s, char esc)
+    {
+        std::string r;
+        for (char c : s) {
+            if (c == '"' || (esc == '\\' && c == '\\'))
+                r += esc;
+            r += c;
+        }
+        return r;
+    }
+};
+
+/*
+ * What was run; every interval and summary record starts with these fields.
+ */
+struct RunInfo {
+    std::string bench;      // local, client, server
+    std::string backend;    // PM device or RDMA server address
+    std::string pattern;    // access pattern
+    int threads;
+    uint32_t granularity;
+
+    Record record(const char *type) const
+    {
+        Record r;
+        r.add("type", type).add("bench", bench).add("backend", backend).add("pattern", pattern)
+         .add("threads", threads).add("granularity", granularity);
+        return r;
+    }
+};
+
+/*
+ * Host and build metadata attached to summary records.
+ */
+static inline void add_run_meta(Record &r)
+{
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+
+    struct utsname uts;
+    std::string kernel = "unknown";
+    if (uname(&uts) == 0)
+        kernel = std::string(uts.sysname) + " " + uts.release;
+
+    std::string cpu = "unknown";
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f != nullptr) {
+        char line[512];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            if (strncmp(line, "model name", 10) == 0) {
+                char *p = strchr(line, ':');
+                if (p != nullptr) {
+                    cpu = p + 2;
+                    cpu.erase(cpu.find_last_not_of("\n") + 1);
+                }
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    r.add("host", host).add("cpu", cpu).add("ncpus", (uint64_t)sysconf(_SC_NPROCESSORS_ONLN))
+     .add("kernel", kernel).add("git_rev", GIT_REV).add("timestamp", (uint64_t)time(nullptr));
+}
+
+static inline void report_interval(const RunInfo &info, OutputFormat fmt, int seq, double secs,
+                                   uint64_t ops, uint64_t bytes)
+{
+    if (fmt == FmtText) {
+        printf("%.3lf GB/s\n", bytes / 1e9 / secs);
+        return;
+    }
+    info.record("interval")
+        .add("seq", seq).add("secs", secs).add("ops", ops).add("bytes", bytes)
+        .add("gbps", bytes / 1e9 / secs).add("mops", ops / 1e6 / secs)
+        .print(fmt);
+}
+
+/*
+ * Build the final summary record; callers may append extra fields before
+ * printing it.
+ */
+static inline Record summary_record(const RunInfo &info, double secs, uint64_t ops, uint64_t bytes,
+                                    const LatHist &lat)
+{
+    Record r = info.record("summary");
+    r.add("secs", secs).add("ops", ops).add("bytes", bytes)
+     .add("gbps", bytes / 1e9 / secs).add("mops", ops / 1e6 / secs)
+     .add("lat_samples", lat.total)
+     .add("lat_p50_ns", lat.percentile(0.5)).add("lat_p90_ns", lat.percentile(0.9))
+     .add("lat_p99_ns", lat.percentile(0.99)).add("lat_p999_ns", lat.percentile(0.999))
+     .add("lat_max_ns", lat.max);
+    add_run_meta(r);
+    return r;
+}
+
+/*
+ * Open-loop load. Each thread schedules ops at its share of an offered rate,
+ * evenly spaced or as a Poisson process, and measures latency from the
+ * scheduled issue time: an op delayed behind a slow one is charged for the
+ * wait instead of being silently issued later (coordinated omission). The
+ * offered rate steps through 1/OpenLoopSteps..1 of the maximum.
+ */
+static const int OpenLoopSteps = 10;
+static const int OpenLoopStepSecs = 3;
+
+enum Arrival {
+    ArrivalFixed = 0,
+    ArrivalPoisson,
+};
+
+static inline Arrival parse_arrival(const char *s)
+{
+    if (strcmp(s, "fixed") == 0)
+        return ArrivalFixed;
+    if (strcmp(s, "poisson") == 0)
+        return ArrivalPoisson;
+    fprintf(stderr, "unknown arrival process %s (fixed, poisson)\n", s);
+    exit(-1);
+}
+
+struct ArrivalClock {
+    Arrival kind = ArrivalPoisson;
+    double gap = 0;             // mean TSC ticks between arrivals
+    double next = 0;
+    uint64_t rng = 1;
+
+    void reset(double ops_per_sec, Arrival a, uint64_t seed)
+    {
+        kind = a;
+        gap = tsc_per_ns() * 1e9 / ops_per_sec;
+        next = (double)rdtsc();
+        rng = seed * 0x9e3779b97f4a7c15ull | 1;
+    }
+
+    // scheduled issue time of the next op
+    uint64_t advance()
+    {
+        uint64_t t = (uint64_t)next;
+        if (kind == ArrivalPoisson) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            double u = ((rng >> 11) + 0.5) / 9007199254740992.0;
+            next += -std::log(u) * gap;
+        } else {
+            next += gap;
+        }
+        return t;
+    }
+};
+
+static inline Record open_loop_record(const RunInfo &info, const char *arrival, double offered, double secs,
+                                      uint64_t bytes_per_op, const LatHist &lat)
+{
+    Record r = info.record("openloop");
+    r.add("arrival", arrival).add("offered_ops", offered, 0).add("achieved_ops", lat.total / secs, 0)
+     .add("gbps", lat.total * bytes_per_op / 1e9 / secs)
+     .add("lat_p50_ns", lat.percentile(0.5)).add("lat_p90_ns", lat.percentile(0.9))
+     .add("lat_p99_ns", lat.percentile(0.99)).add("lat_p999_ns", lat.percentile(0.999))
+     .add("lat_max_ns", lat.max);
+    return r;
+}
+
+/*
+ * Per-thread hardware counters (perf_event_open group).
+ * Stalls are the generic backend-stall event, or, where the CPU has no such
+ * event, the raw CYCLE_ACTIVITY.STALLS_MEM_ANY on Skylake-SP/Cascade Lake
+ * only. Events the CPU or hypervisor does not expose are skipped; if the
+ * group leader (cycles) cannot be opened at all, or the group never got on
+ * the PMU, the whole group is reported as unavailable. Counts of a
+ * multiplexed group are scaled up by enabled / running time.
+ */
+enum PerfEvent {
+    PerfCycles = 0,
+    PerfInstructions,
+    PerfLlcMisses,
+    PerfBackendStalls,
+    PerfMemStalls,
+    PerfNEvents,
+};
+
+static const char *PerfEventNames[PerfNEvents] = {"cycles", "instructions", "llc_misses",
+                                                  "backend_stall_cycles", "mem_stall_cycles"};
+
+struct PerfCounters {
+    uint64_t val[PerfNEvents] = {0};
+    bool has[PerfNEvents] = {false};
+    uint64_t enabled = 0;       // ns the group was enabled / on the PMU
+    uint64_t running = 0;
+
+    void merge(const PerfCounters &o)
+    {
+        for (int i = 0; i < PerfNEvents; ++i) {
+            val[i] += o.val[i];
+            has[i] = has[i] || o.has[i];
+        }
+        enabled += o.enabled;
+        running += o.running;
+    }
+
+    bool valid() const { return has[PerfCycles] && running > 0; }
+};
+
+/*
+ * Intel Skylake-SP / Cascade Lake / Cooper Lake (family 6, model 0x55),
+ * the CPUs whose CYCLE_ACTIVITY.STALLS_MEM_ANY encoding we use.
+ */
+static inline bool cpu_is_skx()
+{
+    unsigned a, b, c, d;
+    if (!__get_cpuid(0, &a, &b, &c, &d) || b != 0x756e6547 || d != 0x49656e69 || c != 0x6c65746e)
+        return false;       // not "GenuineIntel"
+    __get_cpuid(1, &a, &b, &c, &d);
+    unsigned family = (a >> 8) & 0xf, model = ((a >> 4) & 0xf) | ((a >> 12) & 0xf0);
+    return family == 6 && model == 0x55;
+}
+
+class PerfGroup {
+    int fd[PerfNEvents] = {-1, -1, -1, -1, -1};
+    uint64_t id[PerfNEvents] = {0};
+
+    static int perf_open(uint32_t type, uint64_t config, int group_fd)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group_fd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+
+public:
+    /*
+     * Open the group for the calling thread; returns false if no counter is
+     * available.
+     */
+    bool open()
+    {
+        fd[PerfCycles] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (fd[PerfCycles] < 0) {
+            static std::atomic_bool warned = false;
+            if (!warned.exchange(true))
+                fprintf(stderr, "perf counters unavailable: %s\n", strerror(errno));
+            return false;
+        }
+        int leader = fd[PerfCycles];
+        fd[PerfInstructions] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+        fd[PerfLlcMisses] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, leader);
+        fd[PerfBackendStalls] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, leader);
+        if (fd[PerfBackendStalls] < 0 && cpu_is_skx())
+            fd[PerfMemStalls] = perf_open(PERF_TYPE_RAW, 0x140014a3, leader);
+
+        for (int i = 0; i < PerfNEvents; ++i)
+            if (fd[i] >= 0)
+                ioctl(fd[i], PERF_EVENT_IOC_ID, &id[i]);
+        return true;
+    }
+
+    void enable()
+    {
+        if (fd[PerfCycles] >= 0) {
+            ioctl(fd[PerfCycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fd[PerfCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    void disable()
+    {
+        if (fd[PerfCycles] >= 0)
+            ioctl(fd[PerfCycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    PerfCounters read() const
+    {
+        PerfCounters c;
+        if (fd[PerfCycles] < 0)
+            return c;
+
+        struct {
+            uint64_t nr;
+            uint64_t time_enabled;
+            uint64_t time_running;
+            struct {
+                uint64_t value;
+                uint64_t id;
+            } values[PerfNEvents];
+        } buf;
+        if (::read(fd[PerfCycles], &buf, sizeof(buf)) <= 0 || buf.time_running == 0)
+            return c;
+        const double scale = (double)buf.time_enabled / buf.time_running;
+        for (uint64_t k = 0; k < buf.nr && k < PerfNEvents; ++k) {
+            for (int i = 0; i < PerfNEvents; ++i) {
+                if (fd[i] >= 0 && id[i] == buf.values[k].id) {
+                    c.val[i] = (uint64_t)(buf.values[k].value * scale);
+                    c.has[i] = true;
+                }
+            }
+        }
+        c.enabled = buf.time_enabled;
+        c.running = buf.time_running;
+        return c;
+    }
+
+    ~PerfGroup()
+    {
+        for (int i = 0; i < PerfNEvents; ++i)
+            if (fd[i] >= 0)
+                close(fd[i]);
+    }
+};
+
+/*
+ * Append per-op and per-byte counter values to a (summary) record.
+ */
+static inline void add_perf_fields(Record &r, const PerfCounters &c, uint64_t ops, uint64_t bytes)
+{
+    if (!c.valid()) {
+        r.add("perf", "unavailable");
+        return;
+    }
+    for (int i = 0; i < PerfNEvents; ++i) {
+        if (!c.has[i])
+            continue;
+        std::string name = PerfEventNames[i];
+        r.add((name + "_per_op").c_str(), ops ? (double)c.val[i] / ops : 0.0, 2);
+        r.add((name + "_per_byte").c_str(), bytes ? (double)c.val[i] / bytes : 0.0, 4);
+    }
+    if (c.has[PerfInstructions])
+        r.add("ipc", (double)c.val[PerfInstructions] / c.val[PerfCycles], 3);
+    if (c.running < c.enabled)
+        r.add("perf_running_frac", (double)c.running / c.enabled, 3);
+}
+
+#endif // BENCH_H
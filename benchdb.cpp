@@ -0,0 +1,351 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * Benchmark results store.
+ *
+ * Summary records produced by `-f json` (local, client) are appended to a
+ * local store, one JSON object per line, tagged with a run label. Results are
+ * grouped by configuration (bench, backend, pattern, threads, granularity),
+ * and the tool reports per-configuration baselines and flags statistically
+ * significant regressions between two runs.
+ */
+
+using Fields = std::map<std::string, std::string>;
+
+static const char *KeyFields[] = {"bench", "backend", "pattern", "threads", "granularity"};
+static const char *Metric = "gbps";
+static const double Alpha = 0.05;
+
+/*
+ * Parse one flat JSON object as emitted by Record::print.
+ */
+bool parse_flat_json(const std::string &line, Fields &out)
+{
+    size_t i = 0, n = line.size();
+    auto skip_ws = [&] { while (i < n && isspace((unsigned char)line[i])) ++i; };
+    auto parse_str = [&](std::string &s) {
+        if (line[i] != '"')
+            return false;
+        for (++i; i < n && line[i] != '"'; ++i) {
+            if (line[i] == '\\' && i + 1 < n)
+                ++i;
+            s += line[i];
+        }
+        if (i >= n)
+            return false;
+        ++i;
+        return true;
+    };
+
+    skip_ws();
+    if (i >= n || line[i++] != '{')
+        return false;
+    while (true) {
+        skip_ws();
+        if (i < n && line[i] == '}')
+            return true;
+        std::string k, v;
+        if (!parse_str(k))
+            return false;
+        skip_ws();
+        if (i >= n || line[i++] != ':')
+            return false;
+        skip_ws();
+        if (i < n && line[i] == '"') {
+            if (!parse_str(v))
+                return false;
+        } else {
+            while (i < n && line[i] != ',' && line[i] != '}' && !isspace((unsigned char)line[i]))
+                v += line[i++];
+        }
+        out[k] = v;
+        skip_ws();
+        if (i < n && line[i] == ',')
+            ++i;
+        else if (i < n && line[i] == '}')
+            return true;
+        else
+            return false;
+    }
+}
+
+std::string config_key(const Fields &f)
+{
+    std::string key;
+    for (const char *k : KeyFields) {
+        auto it = f.find(k);
+        key += (key.empty() ? "" : " ") + std::string(k) + "=" + (it == f.end() ? "?" : it->second);
+    }
+    return key;
+}
+
+std::vector<Fields> load_store(const char *path)
+{
+    std::vector<Fields> rows;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        Fields f;
+        if (parse_flat_json(line, f))
+            rows.push_back(f);
+    }
+    return rows;
+}
+
+/*
+ * Statistics: mean/variance, Student's t distribution via the regularized
+ * incomplete beta function (continued fraction, as in Numerical Recipes).
+ */
+struct Stat {
+    size_t n = 0;
+    double mean = 0;
+    double var = 0;
+};
+
+Stat stat_of(const std::vector<double> &v)
+{
+    Stat s;
+    s.n = v.size();
+    if (s.n == 0)
+        return s;
+    for (double x : v)
+        s.mean += x;
+    s.mean /= s.n;
+    if (s.n > 1) {
+        for (double x : v)
+            s.var += (x - s.mean) * (x - s.mean);
+        s.var /= (s.n - 1);
+    }
+    return s;
+}
+
+double betacf(double a, double b, double x)
+{
+    const int MaxIter = 200;
+    const double Eps = 3e-12, FpMin = 1e-300;
+    double qab = a + b, qap = a + 1, qam = a - 1;
+    double c = 1, d = 1 - qab * x / qap;
+    if (fabs(d) < FpMin)
+        d = FpMin;
+    d = 1 / d;
+    double h = d;
+    for (int m = 1; m <= MaxIter; ++m) {
+        int m2 = 2 * m;
+        double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+        d = 1 + aa * d;
+        if (fabs(d) < FpMin)
+            d = FpMin;
+        c = 1 + aa / c;
+        if (fabs(c) < FpMin)
+            c = FpMin;
+        d = 1 / d;
+        h *= d * c;
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+        d = 1 + aa * d;
+        if (fabs(d) < FpMin)
+            d = FpMin;
+        c = 1 + aa / c;
+        if (fabs(c) < FpMin)
+            c = FpMin;
+        d = 1 / d;
+        double del = d * c;
+        h *= del;
+        if (fabs(del - 1) < Eps)
+            break;
+    }
+    return h;
+}
+
+double betai(double a, double b, double x)
+{
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    double bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2))
+        return bt * betacf(a, b, x) / a;
+    return 1 - bt * betacf(b, a, 1 - x) / b;
+}
+
+// two-sided p-value of Student's t with df degrees of freedom
+double t_pvalue(double t, double df)
+{
+    return betai(df / 2, 0.5, df / (df + t * t));
+}
+
+// critical value t such that the two-sided p-value is alpha, by bisection
+double t_critical(double alpha, double df)
+{
+    double lo = 0, hi = 1000;
+    for (int i = 0; i < 100; ++i) {
+        double mid = (lo + hi) / 2;
+        if (t_pvalue(mid, df) > alpha)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (lo + hi) / 2;
+}
+
+std::map<std::string, std::vector<double>> samples_of(const std::vector<Fields> &rows, const char *run)
+{
+    std::map<std::string, std::vector<double>> res;
+    for (auto &f : rows) {
+        if (run != nullptr) {
+            auto r = f.find("run"), g = f.find("git_rev");
+            bool match = (r != f.end() && r->second == run) || (g != f.end() && g->second == run);
+            if (!match)
+                continue;
+        }
+        auto m = f.find(Metric);
+        if (m == f.end())
+            continue;
+        res[config_key(f)].push_back(atof(m->second.c_str()));
+    }
+    return res;
+}
+
+int cmd_ingest(const char *store, const char *label, int nfiles, char **files)
+{
+    int fd = open(store, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", store, strerror(errno));
+        exit(-1);
+    }
+
+    int added = 0;
+    auto ingest = [&](std::istream &in) {
+        std::string line;
+        while (std::getline(in, line)) {
+            Fields f;
+            if (!parse_flat_json(line, f) || f["type"] != "summary")
+                continue;
+            std::string run = label != nullptr ? label : f["git_rev"];
+            std::string out = line.substr(0, line.rfind('}')) + ", \"run\": \"" + run + "\"}\n";
+            if (write(fd, out.data(), out.size()) != (ssize_t)out.size()) {
+                fprintf(stderr, "cannot append to %s: %s\n", store, strerror(errno));
+                exit(-1);
+            }
+            added++;
+        }
+    };
+
+    if (nfiles == 0)
+        ingest(std::cin);
+    for (int i = 0; i < nfiles; ++i) {
+        std::ifstream in(files[i]);
+        if (!in) {
+            fprintf(stderr, "cannot open %s\n", files[i]);
+            exit(-1);
+        }
+        ingest(in);
+    }
+    fsync(fd);
+    close(fd);
+    printf("ingested %d summary records into %s\n", added, store);
+    return 0;
+}
+
+int cmd_baseline(const char *store, const char *run)
+{
+    auto samples = samples_of(load_store(store), run);
+    printf("%-80s %4s %10s %10s %10s\n", "config", "n", "mean", "ci95-", "ci95+");
+    for (auto &[key, v] : samples) {
+        Stat s = stat_of(v);
+        double half = s.n > 1 ? t_critical(Alpha, s.n - 1) * sqrt(s.var / s.n) : 0;
+        printf("%-80s %4zu %10.3lf %10.3lf %10.3lf\n", key.c_str(), s.n, s.mean, s.mean - half, s.mean + half);
+    }
+    return 0;
+}
+
+/*
+ * Welch's t-test between the samples of two runs for every shared config.
+ * Exit status is 1 when any regression is flagged, so scripts can gate on it.
+ */
+int cmd_compare(const char *store, const char *base, const char *cand)
+{
+    auto rows = load_store(store);
+    auto a = samples_of(rows, base);
+    auto b = samples_of(rows, cand);
+
+    int regressions = 0;
+    printf("%-80s %10s %10s %8s %8s  %s\n", "config", base, cand, "delta%", "p", "verdict");
+    for (auto &[key, va] : a) {
+        auto it = b.find(key);
+        if (it == b.end())
+            continue;
+        Stat sa = stat_of(va), sb = stat_of(it->second);
+        double delta = sa.mean > 0 ? (sb.mean - sa.mean) / sa.mean * 100 : 0;
+
+        double p = 1;
+        const char *verdict = "n/a (need >= 2 samples each)";
+        if (sa.n > 1 && sb.n > 1) {
+            double va_n = sa.var / sa.n, vb_n = sb.var / sb.n;
+            double se = sqrt(va_n + vb_n);
+            if (se == 0) {
+                p = sa.mean == sb.mean ? 1 : 0;
+            } else {
+                double t = (sb.mean - sa.mean) / se;
+                double df = (va_n + vb_n) * (va_n + vb_n) /
+                            (va_n * va_n / (sa.n - 1) + vb_n * vb_n / (sb.n - 1));
+                p = t_pvalue(t, df);
+            }
+            if (p >= Alpha)
+                verdict = "same";
+            else if (sb.mean < sa.mean) {
+                verdict = "REGRESSION";
+                regressions++;
+            } else
+                verdict = "improvement";
+        }
+        printf("%-80s %10.3lf %10.3lf %+8.2lf %8.4lf  %s\n", key.c_str(), sa.mean, sb.mean, delta, p, verdict);
+    }
+    return regressions ? 1 : 0;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Benchmark results store\n");
+    fprintf(stderr, "Usage: %s ingest <store> [-l <run label>] [<results.json>...]  (stdin if no file)\n", prog);
+    fprintf(stderr, "       %s baseline <store> [<run>]\n", prog);
+    fprintf(stderr, "       %s compare <store> <base run> <new run>\n", prog);
+    fprintf(stderr, "A run is matched by its ingest label or its git revision.\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+        usage(argv[0]);
+
+    const char *cmd = argv[1], *store = argv[2];
+    if (strcmp(cmd, "ingest") == 0) {
+        const char *label = nullptr;
+        int first = 3;
+        if (argc > 4 && strcmp(argv[3], "-l") == 0) {
+            label = argv[4];
+            first = 5;
+        }
+        return cmd_ingest(store, label, argc - first, argv + first);
+    }
+    if (strcmp(cmd, "baseline") == 0)
+        return cmd_baseline(store, argc > 3 ? argv[3] : nullptr);
+    if (strcmp(cmd, "compare") == 0 && argc > 4)
+        return cmd_compare(store, argv[3], argv[4]);
+
+    usage(argv[0]);
+    return -1;
+}
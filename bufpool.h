@@ -0,0 +1,157 @@
+#if !defined(BUFPOOL_H)
+#define BUFPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <linux/mman.h>
+#include <atomic>
+#include <vector>
+
+/*
+ * Local buffer pool for RDMA.
+ *
+ * One region, backed by 1GB or 2MB hugepages when the system has them, is
+ * registered once as a whole. Buffers come in power-of-two size classes from
+ * 64B to 1GB. A class is carved in slabs of at least PoolSlabSize, and a slab
+ * belongs to the thread that carved it.
+ *
+ * A thread allocates from its own free lists without atomics. A buffer freed
+ * by another thread is pushed on the owner's remote-free stack (lock-free),
+ * which the owner takes over as a whole once its own list runs dry.
+ */
+
+static const size_t PoolSlabSize = 2ul << 20;
+static const int PoolMinShift = 6;
+static const int PoolClasses = 25;              // 64B .. 1GB
+static const int PoolMaxThreads = 64;
+
+struct PoolFree {
+    PoolFree *next;
+};
+
+struct alignas(64) PoolCache {
+    PoolFree *local[PoolClasses] = {};
+    std::atomic<PoolFree *> remote[PoolClasses] = {};
+};
+
+static inline int pool_class(size_t sz)
+{
+    int c = 0;
+    while (c < PoolClasses && ((size_t)1 << (PoolMinShift + c)) < sz)
+        c++;
+    return c < PoolClasses ? c : -1;
+}
+
+static inline size_t pool_class_size(int c) { return (size_t)1 << (PoolMinShift + c); }
+
+/*
+ * Anonymous memory of at least `size` bytes on the largest page size that
+ * works; `page` tells which one it got. 1GB pages only back sizes of at
+ * least 3/4 GB, a smaller pool is not worth rounding up to a whole one.
+ */
+static inline char *map_huge(size_t &size, size_t &page)
+{
+    static const size_t pages[] = {1ul << 30, 2ul << 20};
+    static const size_t min_size[] = {768ul << 20, 0};
+    static const int flags[] = {MAP_HUGETLB | MAP_HUGE_1GB, MAP_HUGETLB | MAP_HUGE_2MB};
+    for (int i = 0; i < 2; ++i) {
+        if (size < min_size[i])
+            continue;
+        size_t sz = (size + pages[i] - 1) / pages[i] * pages[i];
+        void *p = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags[i], -1, 0);
+        if (p != MAP_FAILED) {
+            size = sz;
+            page = pages[i];
+            return (char *)p;
+        }
+    }
+    size = (size + PoolSlabSize - 1) / PoolSlabSize * PoolSlabSize;
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "cannot map %lu bytes: %s\n", size, strerror(errno));
+        exit(-1);
+    }
+    madvise(p, size, MADV_HUGEPAGE);
+    page = 4096;
+    return (char *)p;
+}
+
+struct BufPool {
+    char *base = nullptr;
+    size_t size = 0;
+    size_t page = 0;                    // backing page size
+    std::atomic<size_t> top{0};         // bytes carved into slabs so far
+    std::vector<uint16_t> slab_owner;   // per PoolSlabSize unit
+    std::vector<uint8_t> slab_class;
+    PoolCache caches[PoolMaxThreads];
+
+    void init(size_t sz)
+    {
+        size = sz;
+        base = map_huge(size, page);
+        slab_owner.assign(size / PoolSlabSize, 0);
+        slab_class.assign(size / PoolSlabSize, 0);
+    }
+
+    /*
+     * A buffer of at least `sz` bytes for thread `tid`, aligned to its size
+     * class up to PoolSlabSize; nullptr when the pool is exhausted.
+     */
+    void *alloc(int tid, size_t sz)
+    {
+        int c = pool_class(sz);
+        if (c < 0)
+            return nullptr;
+        PoolCache &pc = caches[tid];
+        if (pc.local[c] == nullptr)
+            pc.local[c] = pc.remote[c].exchange(nullptr, std::memory_order_acquire);
+        if (pc.local[c] == nullptr && !carve(tid, c))
+            return nullptr;
+        PoolFree *f = pc.local[c];
+        pc.local[c] = f->next;
+        return f;
+    }
+
+    void free(int tid, void *p)
+    {
+        size_t unit = ((char *)p - base) / PoolSlabSize;
+        int owner = slab_owner[unit], c = slab_class[unit];
+        PoolFree *f = (PoolFree *)p;
+        if (owner == tid) {
+            f->next = caches[tid].local[c];
+            caches[tid].local[c] = f;
+            return;
+        }
+        std::atomic<PoolFree *> &stack = caches[owner].remote[c];
+        f->next = stack.load(std::memory_order_relaxed);
+        while (!stack.compare_exchange_weak(f->next, f, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+private:
+    bool carve(int tid, int c)
+    {
+        const size_t csz = pool_class_size(c);
+        const size_t slab = csz > PoolSlabSize ? csz : PoolSlabSize;
+        size_t off = top.fetch_add(slab, std::memory_order_relaxed);
+        if (off + slab > size)
+            return false;
+        for (size_t u = off / PoolSlabSize; u < (off + slab) / PoolSlabSize; ++u) {
+            slab_owner[u] = tid;
+            slab_class[u] = c;
+        }
+        PoolFree *head = nullptr;
+        for (size_t i = slab / csz; i > 0; --i) {
+            PoolFree *f = (PoolFree *)(base + off + (i - 1) * csz);
+            f->next = head;
+            head = f;
+        }
+        caches[tid].local[c] = head;
+        return true;
+    }
+};
+
+#endif // BUFPOOL_H
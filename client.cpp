@@ -8,101 +8,684 @@
 #include <chrono>
 
 #include "rlibv2/lib.hh"
+#include "rlibv2/qps/op.hh"
 #include "common.h"
+#include "bench.h"
+#include "record.h"
+#include "rpc.h"
+#include "bufpool.h"
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
 using namespace rdmaio::qp;
 
 static const int QpTimeout = 2;
-static const size_t LocalMemSize = 1ul << 30;
 
 static const int MaxNThreads = 8;
 static int NThreads = 1;
 static u32 Granularity = 64;
 
-static const int NTests = 10000000;
+static const u64 NTests = 10000000;
+static u64 NOps = NTests;
 static const int Batch = 8;
 static const auto IOMode = IBV_WR_RDMA_WRITE;
 
+enum Mode {
+    ModeWrite = 0,      // overwrite remote PM sequentially
+    ModeRecord,         // write self-describing records until killed
+    ModeOpen,           // like ModeWrite, open loop at stepped offered rates
+    ModeRpc,            // SEND requests, the server persists them and replies
+    ModeImm,            // like ModeWrite, with immediates the server persists on
+    ModeUd,             // like ModeRpc, over UD datagrams
+    ModeSge,            // like ModeWrite, each write gathered from NFrags local fragments
+    ModeSgeBounce,      // the fragments copied into a bounce buffer, one SGE
+    ModeSgeSplit,       // one write per fragment
+    NModes,
+};
+static const char *ModeNames[NModes] = {"write", "record", "open", "rpc", "imm", "ud", "sge", "sge-bounce",
+                                        "sge-split"};
+static const char *ModePatterns[NModes] = {"seq-write", "seq-record", "seq-write-open", "rpc-send", "seq-write-imm",
+                                           "ud-send", "seq-write-sge", "seq-write-bounce", "seq-write-split"};
+static Mode BenchMode = ModeWrite;
+
+static int NRemoteMrs = 1;      // server MRs (PM devices) to spread the threads over
+static bool Sweep = false;
+
+// open mode: top offered rate (ops/s, all threads) and arrival process;
+// at most OpenWindow writes per thread are in flight
+static double OpenRateMax = 0;
+static Arrival OpenArrival = ArrivalPoisson;
+static const int OpenWindow = Batch * 2;
+// rpc mode: requests in flight per thread, spread over its QPs (at least
+// one each); RpcQps QPs in total, 0: one per thread
+static const int RpcWindow = Batch;
+static int RpcQps = 0;
+// sge modes: a write is a record header, NFrags - 2 payload pieces and an
+// 8-byte trailer, each fragment in its own FragStride-apart area of the
+// local buffer
+static const int MaxFrags = 16;
+static size_t FragStride = 0;
+static int NFrags = 3;
+static bool PerfCounting = false;
+static OutputFormat Format = FmtText;
+
+static double TscPerNs = 1;
+
 Arc<RC> qps[MaxNThreads];
 u64 thpt[MaxNThreads] = {0};
+// completion latency of the signaled request of each batch, RTT in rpc mode
+LatHist lat[MaxNThreads];
+PerfCounters perf[MaxNThreads];
+
+// chunk table of the MR of each server device; a write uses the rkey of
+// the chunk it falls in
+MRChunks remote_chunks[MaxNThreads];
+
+static inline RegAttr remote_mr(int id, u64 off)
+{
+    const MRChunks &c = remote_chunks[id % NRemoteMrs];
+    RegAttr attr = c.attr;
+    attr.key = c.key_at(off);
+    return attr;
+}
+
+// local buffers: one slab of the registered pool per thread, sized by what
+// the mode keeps in flight
+BufPool pool;
+u8 *thread_bufs[MaxNThreads];
+
+// rpc QP j belongs to thread j % NThreads
+struct RpcConn {
+    Arc<RC> qp;
+    Arc<RpcEntries> entries;
+    u64 sent = 0;
+    u64 done = 0;
+    u64 sent_tsc[RpcWindow];
+};
+RpcConn rpc_conns[RpcMaxQps];
+
+// ud mode: a UD QP per thread, with recvs for the replies; thread i sends to
+// server QP i % NUdServers. Replies missing after UdTimeoutMs are lost.
+static const double UdTimeoutMs = 100;
+Arc<UD> uds[MaxNThreads];
+Arc<UdEntries> ud_entries[MaxNThreads];
+QPAttr ud_servers[UdMaxThreads];
+int NUdServers = 0;
+u64 ud_lost[MaxNThreads] = {0};
+mr_key_t LocalLkey = 0;
 
 void parse_inargs(int argc, char **argv)
 {
-    if (argc < 3) {
+    int opt;
+    while ((opt = getopt(argc, argv, "m:spf:D:O:a:Q:K:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (int m = 0; m < NModes; ++m)
+                if (strcmp(optarg, ModeNames[m]) == 0)
+                    BenchMode = (Mode)m;
+            if (strcmp(optarg, ModeNames[BenchMode]) != 0) {
+                fprintf(stderr, "unknown mode %s\n", optarg);
+                argc = 0;
+            }
+            break;
+        case 's':
+            Sweep = true;
+            break;
+        case 'p':
+            PerfCounting = true;
+            break;
+        case 'f':
+            Format = parse_format(optarg);
+            break;
+        case 'D':
+            NRemoteMrs = std::atoi(optarg);
+            break;
+        case 'O':
+            OpenRateMax = parse_rate(optarg);
+            break;
+        case 'a':
+            OpenArrival = parse_arrival(optarg);
+            break;
+        case 'Q':
+            RpcQps = std::atoi(optarg);
+            break;
+        case 'K':
+            NFrags = std::atoi(optarg);
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+
+    if (argc - optind < 2) {
         fprintf(stderr, "Test PM I/O bandwidth\n");
-        fprintf(stderr, "Usage: %s <NThreads> <Granularity (in bytes)>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-m mode] [-s] [-p] [-D ndev] [-O ops/s] [-a fixed|poisson] [-Q nqps] [-K nfrags] [-f text|csv|json] <NThreads> <Granularity (in bytes)>\n", argv[0]);
+        fprintf(stderr, "  -m  write (default): overwrite remote PM sequentially\n");
+        fprintf(stderr, "      record: write self-describing records until killed;\n");
+        fprintf(stderr, "      check them on the server host with `local -m verify -R 32g`\n");
+        fprintf(stderr, "      open: open-loop writes offered at 1/%d..1 x -O ops/s, %d s per step; latency counts\n",
+                OpenLoopSteps, OpenLoopStepSecs);
+        fprintf(stderr, "            from the scheduled issue time to the completion\n");
+        fprintf(stderr, "      rpc: SEND Granularity-byte requests, %d in flight per thread; the server\n", RpcWindow);
+        fprintf(stderr, "           (started with -r) persists each and replies; latency is the RTT\n");
+        fprintf(stderr, "      imm: like write, with IBV_WR_RDMA_WRITE_WITH_IMM; the server (started with -r)\n");
+        fprintf(stderr, "           persists each written range when the immediate arrives\n");
+        fprintf(stderr, "      ud: like rpc, over UD in batches of %d requests, payload <= %u; the server\n",
+                RpcWindow, UdMaxPayload);
+        fprintf(stderr, "          must run with -u\n");
+        fprintf(stderr, "      sge: like write, each write gathered from -K local fragments by one multi-SGE\n");
+        fprintf(stderr, "           request; sge-bounce: copied into a bounce buffer first; sge-split: one write\n");
+        fprintf(stderr, "           per fragment\n");
+        fprintf(stderr, "  -s  sweep 1..NThreads threads x %uB..Granularity, print a results matrix\n",
+                SweepMinGranularity);
+        fprintf(stderr, "  -p  collect per-thread hardware counters (perf_event)\n");
+        fprintf(stderr, "  -D  number of server PM devices (server -d); thread i writes to device i %% ndev\n");
+        fprintf(stderr, "  -O  open mode: top offered rate in ops/s over all threads (k/m suffixes)\n");
+        fprintf(stderr, "  -a  open mode: arrival process (default poisson)\n");
+        fprintf(stderr, "  -Q  rpc mode: QPs over all threads, at most %d (default one per thread)\n", RpcMaxQps);
+        fprintf(stderr, "  -K  sge modes: fragments per write, header + payload pieces + trailer (default %d)\n",
+                NFrags);
+        fprintf(stderr, "  -f  output format\n");
+        exit(-1);
+    }
+    NThreads = std::atoi(argv[optind]);
+    Granularity = static_cast<u32>(parse_size(argv[optind + 1]));
+
+    if (NThreads < 1 || NThreads > MaxNThreads) {
+        fprintf(stderr, "NThreads must be in [1, %d]\n", MaxNThreads);
+        exit(-1);
+    }
+    if (NRemoteMrs < 1 || NRemoteMrs > MaxNThreads || (BenchMode == ModeRecord && NRemoteMrs != 1)) {
+        fprintf(stderr, "-D must be in [1, %d], and 1 in record mode\n", MaxNThreads);
+        exit(-1);
+    }
+    if (BenchMode == ModeOpen && OpenRateMax <= 0) {
+        fprintf(stderr, "open mode needs -O <ops/s>\n");
+        exit(-1);
+    }
+    if (RpcQps == 0)
+        RpcQps = NThreads;
+    if (BenchMode == ModeRpc && (Granularity > RpcMaxPayload || NRemoteMrs != 1 ||
+                                 RpcQps < NThreads || RpcQps > RpcMaxQps || Sweep)) {
+        fprintf(stderr, "rpc mode needs a Granularity <= %u, a single device, NThreads..%d QPs and no sweep\n",
+                RpcMaxPayload, RpcMaxQps);
         exit(-1);
     }
-    NThreads = std::atoi(argv[1]);
+    if (BenchMode == ModeImm && (Granularity % 64 != 0 || Granularity > ImmMaxLen || NRemoteMrs != 1 || Sweep ||
+                                 RpcQps < NThreads || RpcQps > RpcMaxQps)) {
+        fprintf(stderr, "imm mode needs a Granularity that is a multiple of 64 and <= %u, a single device,\n"
+                "NThreads..%d QPs and no sweep\n", ImmMaxLen, RpcMaxQps);
+        exit(-1);
+    }
+    if (BenchMode == ModeUd && Granularity > UdMaxPayload) {
+        fprintf(stderr, "ud mode needs a Granularity <= %u\n", UdMaxPayload);
+        exit(-1);
+    }
+    if (BenchMode >= ModeSge && (NFrags < 3 || NFrags > MaxFrags || Sweep ||
+                                 Granularity < sizeof(RecordHeader) + 8 + NFrags - 2)) {
+        fprintf(stderr, "sge modes need -K in [3, %d], a Granularity >= %lu + -K and no sweep\n",
+                MaxFrags, sizeof(RecordHeader) + 6);
+        exit(-1);
+    }
+    if (BenchMode == ModeRecord && (Granularity < sizeof(RecordHeader) || Granularity % 8 != 0)) {
+        fprintf(stderr, "records need a Granularity >= %lu and a multiple of 8\n", sizeof(RecordHeader));
+        exit(-1);
+    }
+}
 
-    size_t l = strlen(argv[2]);
-    Granularity = 1;
-    if (argv[2][l - 1] == 'k' || argv[2][l - 1] == 'K') {
-        Granularity = 1u << 10;
-        argv[2][l - 1] = '\0';
+/*
+ * Local buffer bytes a thread needs: its requests in flight, not a fixed
+ * region, so that memory grows with the queue depth only.
+ */
+static size_t thread_buf_size()
+{
+    switch (BenchMode) {
+    case ModeRpc: {
+        // sized for NThreads as started, hence no sweep in rpc mode
+        const int mine = (RpcQps + NThreads - 1) / NThreads;
+        return (size_t)std::max(mine, RpcWindow) * RpcMsgSize;
+    }
+    case ModeUd:
+        return (size_t)RpcWindow * UdMaxMsg;
+    case ModeOpen:
+        return (size_t)OpenWindow * Granularity;
+    case ModeSge:
+    case ModeSgeBounce:
+    case ModeSgeSplit:
+        return (MaxFrags + 1) * FragStride;
+    default:
+        return (size_t)Batch * 2 * Granularity;
     }
-    else if (argv[2][l - 1] == 'm' || argv[2][l - 1] == 'M') {
-        Granularity = 1u << 20;
-        argv[2][l - 1] = '\0';
+}
+
+/*
+ * Layout of a fragmented record of Granularity bytes: header, NFrags - 2
+ * payload pieces, trailer. Remote, the fragments are contiguous.
+ */
+static inline void fragment(int f, u32 &off, u32 &len)
+{
+    const u32 hdr = sizeof(RecordHeader), trailer = 8;
+    const u32 body = Granularity - hdr - trailer, piece = body / (NFrags - 2);
+    if (f == 0) {
+        off = 0;
+        len = hdr;
+    } else if (f == NFrags - 1) {
+        off = Granularity - trailer;
+        len = trailer;
+    } else {
+        off = hdr + (f - 1) * piece;
+        len = f == NFrags - 2 ? body - (f - 1) * piece : piece;
     }
-    Granularity *= static_cast<u32>(std::atoi(argv[2]));
 }
 
-inline void bind_core(uint16_t core)
+/*
+ * Write the fragments of local slot `slot` to `remote` the way the sge mode
+ * says: one request with NFrags SGEs, one SGE from a bounce copy, or one
+ * request per fragment with only the last one carrying `flags`.
+ */
+void post_fragments(int id, u8 *buf, int slot, u64 remote, int flags)
 {
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(core, &cpuset);
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    RC *qp = qps[id].get();
+    const RegAttr local = qp->local_mr.value(), rmr = remote_mr(id, remote);
+    const u32 lkey = local.lkey;
+    auto frag = [&](int f) { return buf + f * FragStride + slot * Granularity; };
+    u32 off, len;
+
+    switch (BenchMode) {
+    case ModeSge: {
+        Op<MaxFrags> op;
+        op.wr.num_sge = NFrags;
+        op.set_write().set_rdma_addr(remote, rmr);
+        for (int f = 0; f < NFrags; ++f) {
+            fragment(f, off, len);
+            op.set_payload(frag(f), len, lkey, f);
+        }
+        op.execute(qps[id], flags);
+        break;
+    }
+    case ModeSgeBounce: {
+        u8 *bounce = buf + MaxFrags * FragStride + slot * Granularity;
+        for (int f = 0; f < NFrags; ++f) {
+            fragment(f, off, len);
+            memcpy(bounce + off, frag(f), len);
+        }
+        qp->send_normal({.op = IOMode, .flags = flags, .len = Granularity, .wr_id = 0},
+                        {.local_addr = bounce, .remote_addr = remote, .imm_data = 0}, local, rmr);
+        break;
+    }
+    default:
+        for (int f = 0; f < NFrags; ++f) {
+            fragment(f, off, len);
+            qp->send_normal({.op = IOMode, .flags = f == NFrags - 1 ? flags : 0, .len = len, .wr_id = 0},
+                            {.local_addr = frag(f), .remote_addr = remote + off, .imm_data = 0}, local, rmr);
+        }
+        break;
+    }
 }
 
 std::atomic_int barrier = 0;
+std::atomic_bool stop = false;
 
 void worker(int id, u8 *buf)
 {
     bind_core(id);
 
+    PerfGroup pg;
+    bool perf_on = PerfCounting && pg.open();
+
     // Barrier
     barrier.fetch_add(1);
     while (barrier.load() != NThreads + 1);
 
-    const size_t Units = (ServerMemSize / NThreads) / Granularity;
-    const size_t Base = Units * Granularity * id;
-    for (int i = 0; i < NTests + Batch; ++i) {
-        if (i < NTests) {
-            qps[id]->send_normal(
-                {
-                    .op = IOMode,
-                    .flags = (i + 1) % Batch == 0 ? IBV_SEND_SIGNALED : 0,
-                    .len = Granularity,
-                    .wr_id = 0
-                },
-                {
-                    .local_addr = reinterpret_cast<RMem::raw_ptr_t>(buf + (i % (Batch * 2)) * Granularity),
-                    .remote_addr = Base + (i % Units) * Granularity,
-                    .imm_data = 0
-                }
-            );
+    if (perf_on)
+        pg.enable();
+
+    // threads sharing a device split it evenly; with immediates thread id
+    // writes to area id and names the offset in the immediate
+    const int peers = (NThreads - id % NRemoteMrs + NRemoteMrs - 1) / NRemoteMrs;
+    const bool imm = BenchMode == ModeImm;
+    const size_t Units = (imm ? ImmAreaSize : ServerMemSize / peers) / Granularity;
+    const size_t Base = imm ? ImmAreaSize * id : Units * Granularity * (id / NRemoteMrs);
+    const u64 run = record_run_id();
+    u64 sig_tsc[2] = {0};
+    u64 n = NOps;
+    for (u64 i = 0; i < n + Batch; ++i) {
+        // stop only at a batch boundary so that every signaled request is reaped
+        if (i < n && i % Batch == 0 && stop.load(std::memory_order_relaxed))
+            n = i;
+        if (i < n) {
+            // a slot is reused 2 batches later, after its batch has completed
+            if (BenchMode == ModeRecord)
+                record_fill((char *)(buf + (i % (Batch * 2)) * Granularity), Granularity,
+                            run, id, Batch * 2, i + 1, Base + (i % Units) * Granularity);
+            if ((i + 1) % Batch == 0)
+                sig_tsc[(i / Batch) & 1] = rdtsc();
+            if (BenchMode >= ModeSge)
+                post_fragments(id, buf, i % (Batch * 2), Base + (i % Units) * Granularity,
+                               (i + 1) % Batch == 0 ? IBV_SEND_SIGNALED : 0);
+            else
+                qps[id]->send_normal(
+                    {
+                        .op = imm ? IBV_WR_RDMA_WRITE_WITH_IMM : IOMode,
+                        .flags = (i + 1) % Batch == 0 ? IBV_SEND_SIGNALED : 0,
+                        .len = Granularity,
+                        .wr_id = 0
+                    },
+                    {
+                        .local_addr = reinterpret_cast<RMem::raw_ptr_t>(buf + (i % (Batch * 2)) * Granularity),
+                        .remote_addr = Base + (i % Units) * Granularity,
+                        .imm_data = imm ? imm_encode(id, (i % Units) * Granularity) : 0
+                    },
+                    qps[id]->local_mr.value(), remote_mr(id, Base + (i % Units) * Granularity)
+                );
         }
         if (i >= Batch && (i + 1) % Batch == 0) {
             qps[id]->wait_one_comp();
+            lat[id].add((u64)((rdtsc() - sig_tsc[(i / Batch - 1) & 1]) / TscPerNs));
             thpt[id] += Batch;
         }
     }
 
+    if (perf_on) {
+        pg.disable();
+        perf[id] = pg.read();
+    }
+
+    barrier.fetch_sub(1);
+}
+
+/*
+ * Two-sided requests: every QP of the thread keeps up to `w` SENDs in flight,
+ * each in its own slot of `buf`, reused once the reply to its previous
+ * request has arrived. Replies come back in order on the QP's recv CQ.
+ */
+void rpc_worker(int id, u8 *buf)
+{
+    bind_core(id);
+
+    PerfGroup pg;
+    bool perf_on = PerfCounting && pg.open();
+
+    barrier.fetch_add(1);
+    while (barrier.load() != NThreads + 1);
+
+    if (perf_on)
+        pg.enable();
+
+    const int mine = (RpcQps - id + NThreads - 1) / NThreads;
+    const u64 w = std::max(1, RpcWindow / mine);
+    u64 sent = 0, done = 0, n = NOps;
+    while (done < n) {
+        if (sent < n && stop.load(std::memory_order_relaxed))
+            n = sent;
+        for (int q = 0; q < mine; ++q) {
+            RpcConn &c = rpc_conns[id + q * NThreads];
+            while (sent < n && c.sent - c.done < w) {
+                const int k = c.sent % w;
+                RpcHeader *h = (RpcHeader *)(buf + (q * w + k) * RpcMsgSize);
+                h->seq = c.sent;
+                h->len = Granularity;
+                c.sent_tsc[k] = rdtsc();
+                c.qp->send_normal(
+                    {
+                        .op = IBV_WR_SEND,
+                        .flags = (c.sent + 1) % Batch == 0 ? IBV_SEND_SIGNALED : 0,
+                        .len = (u32)sizeof(RpcHeader) + Granularity,
+                        .wr_id = 0
+                    },
+                    {
+                        .local_addr = reinterpret_cast<RMem::raw_ptr_t>(h),
+                        .remote_addr = 0,
+                        .imm_data = 0
+                    }
+                );
+                c.sent++;
+                sent++;
+            }
+            for (RpcIter it(c.qp, c.entries); it.has_msgs(); it.next()) {
+                RpcHeader *r = (RpcHeader *)std::get<1>(it.cur_msg().value());
+                lat[id].add((u64)((rdtsc() - c.sent_tsc[r->seq % w]) / TscPerNs));
+                c.done++;
+                done++;
+                thpt[id]++;
+            }
+            while (c.qp->poll_rc_comp());
+        }
+    }
+
+    if (perf_on) {
+        pg.disable();
+        perf[id] = pg.read();
+    }
+
+    barrier.fetch_sub(1);
+}
+
+/*
+ * UD requests go out RpcWindow at a time with one doorbell; the next batch
+ * follows once every reply of the current one has arrived, or is given up
+ * as lost. A late reply to a batch given up on is ignored.
+ */
+void ud_worker(int id, u8 *buf)
+{
+    bind_core(id);
+
+    PerfGroup pg;
+    bool perf_on = PerfCounting && pg.open();
+
+    barrier.fetch_add(1);
+    while (barrier.load() != NThreads + 1);
+
+    if (perf_on)
+        pg.enable();
+
+    AHCache ahs(uds[id]);
+    const QPAttr &server = ud_servers[id % NUdServers];
+    ibv_ah *ah = ahs.query(server);
+    UDSendBatch<RpcWindow> batch;
+    u64 sent_tsc[RpcWindow];
+    const u64 timeout = (u64)(UdTimeoutMs * 1e6 * TscPerNs);
+    for (u64 seq = 0; seq < NOps && !stop.load(std::memory_order_relaxed);) {
+        const u64 first = seq;
+        for (int k = 0; k < RpcWindow; ++k, ++seq) {
+            RpcHeader *h = (RpcHeader *)(buf + k * UdMaxMsg);
+            h->seq = seq;
+            h->len = Granularity;
+            sent_tsc[k] = rdtsc();
+            batch.add(ah, server.qpn, server.qkey, h, sizeof(RpcHeader) + Granularity, LocalLkey);
+        }
+        batch.flush(*uds[id]);
+
+        u64 got = 0;
+        const u64 start = rdtsc();
+        while (got < RpcWindow && rdtsc() - start < timeout) {
+            for (UdIter it(uds[id], ud_entries[id]); it.has_msgs(); it.next()) {
+                RpcHeader *r = (RpcHeader *)((char *)std::get<1>(it.cur_msg().value()) + kGRHSz);
+                if (it.cur_wc().status != IBV_WC_SUCCESS || r->seq < first)
+                    continue;
+                lat[id].add((u64)((rdtsc() - sent_tsc[r->seq - first]) / TscPerNs));
+                got++;
+                thpt[id]++;
+            }
+        }
+        ud_lost[id] += RpcWindow - got;
+    }
+
+    if (perf_on) {
+        pg.disable();
+        perf[id] = pg.read();
+    }
+
     barrier.fetch_sub(1);
 }
 
+typedef void worker_fn(int, u8 *);
+
+static inline worker_fn *bench_worker()
+{
+    if (BenchMode == ModeRpc)
+        return rpc_worker;
+    if (BenchMode == ModeUd)
+        return ud_worker;
+    return worker;
+}
+
+/*
+ * Open loop. Every write is signaled; RC completes them in order, so the
+ * scheduled issue times wait in a ring until their completion arrives. A
+ * write due while OpenWindow are in flight is posted late, but still
+ * charged from its scheduled time.
+ */
+std::atomic_int OpenStep = -1;
+LatHist open_lat[MaxNThreads][OpenLoopSteps];
+
+static inline double open_rate(int step)
+{
+    return OpenRateMax * (step + 1) / OpenLoopSteps;
+}
+
+void open_worker(int id, u8 *buf)
+{
+    bind_core(id);
+    const int peers = (NThreads - id % NRemoteMrs + NRemoteMrs - 1) / NRemoteMrs;
+    const size_t Units = (ServerMemSize / peers) / Granularity;
+    const size_t Base = Units * Granularity * (id / NRemoteMrs);
+
+    ArrivalClock clk;
+    u64 due[OpenWindow];
+    int steps[OpenWindow];
+    u64 issued = 0, done = 0;
+    int step = -1;
+
+    auto reap = [&] {
+        if (qps[id]->poll_rc_comp()) {
+            const int k = done % OpenWindow;
+            open_lat[id][steps[k]].add((u64)((rdtsc() - due[k]) / TscPerNs));
+            done++;
+        }
+    };
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        int s = OpenStep.load(std::memory_order_relaxed);
+        if (s != step) {
+            step = s;
+            if (step >= 0)
+                clk.reset(open_rate(step) / NThreads, OpenArrival, id + 1);
+        }
+        if (step < 0)
+            continue;
+        u64 t = clk.advance();
+        while (rdtsc() < t || issued - done == OpenWindow)
+            reap();
+
+        const int k = issued % OpenWindow;
+        due[k] = t;
+        steps[k] = step;
+        qps[id]->send_normal(
+            {
+                .op = IOMode,
+                .flags = IBV_SEND_SIGNALED,
+                .len = Granularity,
+                .wr_id = 0
+            },
+            {
+                .local_addr = reinterpret_cast<RMem::raw_ptr_t>(buf + k * Granularity),
+                .remote_addr = Base + (issued % Units) * Granularity,
+                .imm_data = 0
+            },
+            qps[id]->local_mr.value(), remote_mr(id, Base + (issued % Units) * Granularity)
+        );
+        issued++;
+    }
+    while (done < issued)
+        reap();
+}
+
+void open_loop()
+{
+    std::thread workers[MaxNThreads];
+    for (int i = 0; i < NThreads; ++i)
+        workers[i] = std::thread(open_worker, i, thread_bufs[i]);
+
+    double secs[OpenLoopSteps];
+    for (int step = 0; step < OpenLoopSteps; ++step) {
+        auto start = std::chrono::steady_clock::now();
+        OpenStep = step;
+        std::this_thread::sleep_for(std::chrono::seconds(OpenLoopStepSecs));
+        secs[step] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    stop = true;
+    for (int i = 0; i < NThreads; ++i)
+        workers[i].join();
+
+    RunInfo info = {"client", std::string("rdma://") + ServerAddr, ModePatterns[ModeOpen], NThreads, Granularity};
+    for (int step = 0; step < OpenLoopSteps; ++step) {
+        LatHist all;
+        for (int i = 0; i < NThreads; ++i)
+            all.merge(open_lat[i][step]);
+        open_loop_record(info, OpenArrival == ArrivalFixed ? "fixed" : "poisson", open_rate(step), secs[step],
+                         Granularity, all)
+            .print(Format);
+    }
+}
+
+/*
+ * Run one sweep point over the already connected QPs and return its bandwidth.
+ */
+double run_point(int nthreads, u32 gran)
+{
+    NThreads = nthreads;
+    Granularity = gran;
+    NOps = UINT64_MAX / 2;
+    memset(thpt, 0, sizeof(thpt));
+    stop = false;
+    barrier = 0;
+
+    std::thread workers[MaxNThreads];
+    for (int i = 0; i < NThreads; ++i)
+        workers[i] = std::thread(bench_worker(), i, thread_bufs[i]);
+
+    barrier.fetch_add(1);
+    while (barrier.load() != NThreads + 1);
+
+    auto total = [] {
+        u64 tot = 0;
+        for (int j = 0; j < NThreads; ++j)
+            tot += thpt[j];
+        return tot;
+    };
+
+    std::this_thread::sleep_for(std::chrono::seconds(SweepWarmupSecs));
+    u64 ops_begin = total();
+    auto start_time = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds(SweepMeasureSecs));
+    u64 ops_end = total();
+    auto end_time = std::chrono::steady_clock::now();
+
+    stop = true;
+    for (int i = 0; i < NThreads; ++i)
+        workers[i].join();
+
+    double secs = std::chrono::duration<double>(end_time - start_time).count();
+    return (ops_end - ops_begin) * Granularity / 1e9 / secs;
+}
+
 int main(int argc, char **argv)
 {
     parse_inargs(argc, argv);
     bind_core(MaxNThreads);
+    TscPerNs = tsc_per_ns();
 
     auto nic = RNic::create(RNicInfo::query_dev_names().at(UseNixIdx)).value();
+    // sge modes: room for NFrags SGEs per request, or for NFrags requests
+    // per write in flight
+    QPConfig config = QPConfig().set_timeout(QpTimeout);
+    if (BenchMode >= ModeSge)
+        config.set_max_send_sge(MaxFrags).set_max_send(std::max((int)kRcMaxSendSz, Batch * 2 * NFrags + 1));
     for (int i = 0; i < NThreads; ++i)
-        qps[i] = RC::create(nic, QPConfig().set_timeout(QpTimeout)).value();
+        qps[i] = RC::create(nic, config).value();
 
     ConnectManager cm(ServerAddr);
     if (cm.wait_ready(1000000, 2) == IOCode::Timeout) {
@@ -117,28 +700,142 @@ int main(int argc, char **argv)
             return 0;
         return reinterpret_cast<RMem::raw_ptr_t>(buf);
     };
-    auto local_mem = Arc<RMem>(new RMem(LocalMemSize * NThreads, aligned_alloc_fn));
+    // one registration covers the whole pool
+    FragStride = (size_t)Batch * 2 * Granularity;
+    const size_t per_thread = thread_buf_size();
+    if (pool_class(per_thread) < 0) {
+        fprintf(stderr, "%lu bytes of local buffer per thread is too large\n", per_thread);
+        exit(-1);
+    }
+    const size_t slab = std::max(pool_class_size(pool_class(per_thread)), PoolSlabSize);
+    pool.init(slab * NThreads);
+    auto reg_start = std::chrono::steady_clock::now();
+    auto local_mem = Arc<RMem>(new RMem(
+        pool.size, [](u64) { return (RMem::raw_ptr_t)pool.base; },
+        [](RMem::raw_ptr_t p, u64 sz) { munmap(p, sz); }));
     auto local_mr = RegHandler::create(local_mem, nic).value();
-    u8 *local_buf = (u8 *)(local_mem->raw_ptr);
-    
-    auto fetch_res = cm.fetch_remote_mr(RegMemName);
-    rmem::RegAttr remote_attr = std::get<1>(fetch_res.desc);
+    const double reg_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - reg_start).count();
+    for (int i = 0; i < NThreads; ++i)
+        thread_bufs[i] = (u8 *)pool.alloc(i, per_thread);
 
-    for (int i = 0; i < NThreads; ++i) {
-        cm.cc_rc("client-qp" + std::to_string(i), qps[i], RegNicName, QPConfig().set_timeout(QpTimeout));
+    // a write must not cross a chunk boundary: the chunk size must be a
+    // multiple of every granularity written, and so of the thread bases
+    u64 top_gran = Granularity;
+    while (Sweep && (top_gran & (top_gran - 1)))
+        top_gran &= top_gran - 1;
+    for (int d = 0; d < NRemoteMrs; ++d) {
+        auto fetch_res = cm.fetch_remote_mr_chunks(RegMemName + d);
+        if (fetch_res != IOCode::Ok) {
+            fprintf(stderr, "cannot fetch MR %d of the server (started with fewer devices?)\n", RegMemName + d);
+            exit(-1);
+        }
+        remote_chunks[d] = std::get<1>(fetch_res.desc);
+        if (remote_chunks[d].num > 1 && (remote_chunks[d].chunk_sz % top_gran != 0 ||
+                                         (BenchMode == ModeImm && ImmAreaSize % Granularity != 0))) {
+            fprintf(stderr, "the server MR is in chunks of %luB, which Granularity must divide\n",
+                    (u64)remote_chunks[d].chunk_sz);
+            exit(-1);
+        }
+    }
 
-        qps[i]->bind_remote_mr(remote_attr);
+    // all the one-sided QPs in one exchange
+    auto connect_start = std::chrono::steady_clock::now();
+    auto cc_res = cm.cc_rc_batch("client-qp", std::vector<Arc<RC>>(qps, qps + NThreads), RegNicName, config);
+    if (cc_res != IOCode::Ok) {
+        fprintf(stderr, "cannot connect QPs: %s\n", std::get<0>(cc_res.desc).c_str());
+        exit(-1);
+    }
+    const double connect_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - connect_start).count();
+    for (int i = 0; i < NThreads; ++i) {
+        qps[i]->bind_remote_mr(remote_chunks[i % NRemoteMrs].attr);
         qps[i]->bind_local_mr(local_mr->get_reg_attr().value());
     }
 
+    // rpc QPs, each with its own recv CQ; replies land in a small region
+    // carved by a bump allocator. In imm mode thread i writes over rpc QP i,
+    // whose server side has recvs for the immediates.
+    if (BenchMode == ModeRpc || BenchMode == ModeImm) {
+        auto reply_mem = Arc<RMem>(new RMem((u64)RpcQps * RpcRecvDepth * recv_slot(sizeof(RpcHeader)),
+                                            aligned_alloc_fn));
+        Arc<AbsRecvAllocator> reply_alloc(new BumpRecvAllocator(RegHandler::create(reply_mem, nic).value()));
+        for (int j = 0; j < RpcQps; ++j) {
+            RpcConn &c = rpc_conns[j];
+            auto recv_cq = Impl::create_cq(nic, RpcRecvDepth);
+            if (recv_cq != IOCode::Ok) {
+                fprintf(stderr, "cannot create recv CQ: %s\n", std::get<1>(recv_cq.desc).c_str());
+                exit(-1);
+            }
+            c.qp = RC::create(nic, QPConfig().set_timeout(QpTimeout), std::get<0>(recv_cq.desc)).value();
+            c.entries = RecvEntriesFactoryv2<RpcRecvDepth>::create(reply_alloc, sizeof(RpcHeader));
+            if (c.qp->post_recvs(*c.entries, RpcRecvDepth) != IOCode::Ok) {
+                fprintf(stderr, "cannot post recvs on rpc QP %d\n", j);
+                exit(-1);
+            }
+            auto res = cm.cc_rc_msg(RpcQpName + std::to_string(j), RpcChannelName + std::to_string(j),
+                                    RpcMsgSize, c.qp, RegNicName, QPConfig().set_timeout(QpTimeout));
+            if (res != IOCode::Ok) {
+                fprintf(stderr, "cannot connect rpc QP %d: %s (server started without -r, or with fewer -Q?)\n",
+                        j, std::get<0>(res.desc).c_str());
+                exit(-1);
+            }
+            c.qp->bind_local_mr(local_mr->get_reg_attr().value());
+            c.qp->bind_remote_mr(remote_chunks[0].attr);
+        }
+        if (BenchMode == ModeImm)
+            for (int i = 0; i < NThreads; ++i)
+                qps[i] = rpc_conns[i].qp;
+    }
+
+    // ud: find the server's UD QPs, replies land in a small region
+    if (BenchMode == ModeUd) {
+        for (; NUdServers < UdMaxThreads; ++NUdServers) {
+            auto res = cm.fetch_qp_attr(UdServerName + std::to_string(NUdServers));
+            if (res != IOCode::Ok)
+                break;
+            ud_servers[NUdServers] = std::get<1>(res.desc);
+        }
+        if (NUdServers == 0) {
+            fprintf(stderr, "no UD QP at the server (started without -u?)\n");
+            exit(-1);
+        }
+        auto reply_mem = Arc<RMem>(new RMem((u64)NThreads * UdRecvDepth * recv_slot(kGRHSz + sizeof(RpcHeader)),
+                                            aligned_alloc_fn));
+        Arc<AbsRecvAllocator> reply_alloc(new BumpRecvAllocator(RegHandler::create(reply_mem, nic).value()));
+        for (int i = 0; i < NThreads; ++i) {
+            uds[i] = UD::create(nic, QPConfig()).value();
+            ud_entries[i] = RecvEntriesFactoryv2<UdRecvDepth>::create(reply_alloc, kGRHSz + sizeof(RpcHeader));
+            if (uds[i]->post_recvs(*ud_entries[i], UdRecvDepth) != IOCode::Ok) {
+                fprintf(stderr, "cannot post recvs on UD QP %d\n", i);
+                exit(-1);
+            }
+        }
+        LocalLkey = local_mr->get_reg_attr().value().lkey;
+    }
+
+    if (BenchMode == ModeRecord)
+        NOps = UINT64_MAX / 2;
+    if (BenchMode == ModeOpen) {
+        open_loop();
+        return 0;
+    }
+
+    if (Sweep) {
+        auto m = run_sweep(NThreads, Granularity, run_point);
+        print_sweep(m, Format);
+        return 0;
+    }
+
+    RunInfo info = {"client", std::string("rdma://") + ServerAddr, ModePatterns[BenchMode], NThreads, Granularity};
+
     std::thread workers[MaxNThreads];
     for (int i = 0; i < NThreads; ++i)
-        workers[i] = std::thread(worker, i, local_buf + i * LocalMemSize);
+        workers[i] = std::thread(bench_worker(), i, thread_bufs[i]);
 
     barrier.fetch_add(1);
     while (barrier.load() != NThreads + 1);
 
     auto start_time = std::chrono::steady_clock::now();
+    auto run_start = start_time;
 
     u64 recent = 0;
     for (int i = 0; barrier.load(std::memory_order_relaxed) > 1; ++i) {
@@ -158,12 +855,34 @@ int main(int argc, char **argv)
         u64 delta = tot - recent;
         recent = tot;
 
-        double thpt_in_gb = (delta * Granularity) / 1e9;
-        printf("%.3lf GB/s\n", thpt_in_gb);
+        report_interval(info, Format, i, 1.0, delta, delta * Granularity);
     }
 
     for (int i = 0; i < NThreads; ++i)
         workers[i].join();
+    auto run_end = std::chrono::steady_clock::now();
+
+    u64 ops = 0;
+    LatHist all;
+    PerfCounters counters;
+    for (int j = 0; j < NThreads; ++j) {
+        ops += thpt[j];
+        all.merge(lat[j]);
+        counters.merge(perf[j]);
+    }
+    double secs = std::chrono::duration<double>(run_end - run_start).count();
+    Record summary = summary_record(info, secs, ops, ops * Granularity, all);
+    if (PerfCounting)
+        add_perf_fields(summary, counters, ops, ops * Granularity);
+    if (BenchMode == ModeUd) {
+        u64 lost = 0;
+        for (int j = 0; j < NThreads; ++j)
+            lost += ud_lost[j];
+        summary.add("lost", lost);
+    }
+    summary.add("local_mr_bytes", (u64)pool.size).add("local_mr_page", (u64)pool.page)
+           .add("local_mr_secs", reg_secs, 6).add("connect_secs", connect_secs, 6);
+    summary.print(Format);
 
     return 0;
 }
@@ -3,106 +3,1126 @@
 #include <cstring>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <vector>
 
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include "persist.h"
+#include "bench.h"
+#include "record.h"
+#include "xpline.h"
+#include "pmlog.h"
+#include "pmdev.h"
 
 using u8 = uint8_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
 using u64 = uint64_t;
 
-static char const *PmDev = "/dev/dax0.0";
+static char const *PmDev = "/dev/dax0.0";     // comma-separated devices, or files standing in for them (-d)
 static const size_t PageSize = 2ul << 20;
-static const u64 MemSize = 128ul << 30;
+static u64 MemSize = 128ul << 30;
 static const int MaxNThreads = 8;
 static int NThreads = 1;
 static u32 Granularity = 64;
 
-static const int NTests = 10000000;
+static const u64 NTests = 10000000;
+static u64 NOps = NTests;
+
+enum Mode {
+    ModeWrite = 0,      // overwrite PM sequentially with memmove_movnt_avx512f_clwb
+    ModeRecord,         // write self-describing records until killed
+    ModeVerify,         // scan PM for torn/missing records left by ModeRecord
+    ModeCrc,            // like ModeWrite, CRC32C folded into the copy
+    ModeCrcSplit,       // like ModeWrite, CRC32C in a separate pass before the copy
+    ModeMemset,         // zero PM sequentially with memset_movnt_avx512f_clwb
+    ModeMemsetAvx,      // same with the AVX2 kernel
+    ModeAdaptive,       // like ModeWrite, with pmem_memcpy_persist after calibrating its threshold
+    ModeAppend,         // append Granularity-sized entries to a per-thread log, each persisted on its own
+    ModeAppendStaged,   // same, gathered into whole XPLines by XPLineBuffer
+    ModeLog,            // multi-producer PmLog appends with group commit
+    ModeLogRecover,     // recovery scan of the PmLog left by ModeLog
+    ModeAlign,          // sweep kernels over dst/src offsets and lengths, single thread
+    ModeCompact,        // slide overlapping ranges within PM, backward and forward
+    ModeMixed,          // random readers against a ramping sequential write load
+    ModeOpen,           // like ModeWrite, open loop at stepped offered rates
+    NModes,
+};
+static const char *ModeNames[NModes] = {"write", "record", "verify", "crc", "crc-split", "memset", "memset-avx2",
+                                        "adaptive", "append", "append-staged", "log", "log-recover", "align",
+                                        "compact", "mixed", "open"};
+static const char *ModePatterns[NModes] = {"seq-write", "seq-record", "verify", "seq-write-crc", "seq-write-crc-split",
+                                           "seq-memset", "seq-memset-avx2", "seq-write-adaptive",
+                                           "log-append", "log-append-staged", "wal-append", "wal-recover", "align",
+                                           "compact", "rand-read+seq-write", "seq-write-open"};
+static Mode BenchMode = ModeWrite;
+
+static bool Sweep = false;
+static bool PerfCounting = false;
+static bool GenericKernel = false;
+static u32 GroupCommit = 8;     // log entries per commit
+static const u32 AlignAllOffsets = 128; // align mode: shorter lengths try every offset
+static int AlignOffsetStep = 4; // align mode: offset step for longer ones
+static size_t Stripe = 0;       // interleave devices at this unit (write mode), 0: per-thread device
+
+// compact mode checks one out of every (CompactCheckMask + 1) moves
+static const u64 CompactCheckMask = 63;
+
+// mixed mode: readers out of NThreads, their granularity, per-thread rate
+// limits in MB/s (0: none), and whether they read the writers' region
+static int NReaders = -1;
+static u32 ReadGranularity = 0;
+static u64 WriteRateMax = 0;
+static u64 ReadRate = 0;
+static bool SharedRegion = false;
+static const int MixedStepSecs = 3;
+static const int MixedMaxSteps = 6;            // idle, 1/4..1 x -W, unlimited
+
+// open mode: top offered rate (ops/s, all threads) and arrival process
+static double OpenRateMax = 0;
+static Arrival OpenArrival = ArrivalPoisson;
+static OutputFormat Format = FmtText;
+
+// one out of every (LatSampleMask + 1) ops is timed
+static const u64 LatSampleMask = 15;
+static double TscPerNs = 1;
 
 u64 thpt[MaxNThreads] = {0};
+u32 crcs[MaxNThreads] = {0};    // keeps the checksums of the crc modes alive
+LatHist lat[MaxNThreads];
+LatHist commit_lat[MaxNThreads];
+u64 compact_errors[MaxNThreads] = {0};
+PmLog Log;
+PmBackend Pm;
+PmPlace Place[MaxNThreads];     // core and device share of each worker
+PerfCounters perf[MaxNThreads];
+
+/*
+ * Spread n workers over the devices, see PmBackend::place(). The main thread
+ * keeps core MaxNThreads.
+ */
+void place_workers(int n)
+{
+    for (int i = 0; i < n; ++i)
+        Place[i] = Pm.place(i, n, MaxNThreads);
+}
 
 void parse_inargs(int argc, char **argv)
 {
-    if (argc < 3) {
+    int opt;
+    while ((opt = getopt(argc, argv, "m:R:spgo:f:d:c:S:r:G:W:L:XO:a:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (int m = 0; m < NModes; ++m)
+                if (strcmp(optarg, ModeNames[m]) == 0)
+                    BenchMode = (Mode)m;
+            if (strcmp(optarg, ModeNames[BenchMode]) != 0) {
+                fprintf(stderr, "unknown mode %s\n", optarg);
+                argc = 0;
+            }
+            break;
+        case 'R':
+            MemSize = parse_size(optarg);
+            break;
+        case 's':
+            Sweep = true;
+            break;
+        case 'p':
+            PerfCounting = true;
+            break;
+        case 'g':
+            GenericKernel = true;
+            break;
+        case 'o':
+            AlignOffsetStep = std::atoi(optarg);
+            break;
+        case 'd':
+            PmDev = optarg;
+            break;
+        case 'c':
+            GroupCommit = static_cast<u32>(std::atoi(optarg));
+            break;
+        case 'S':
+            Stripe = parse_size(optarg);
+            break;
+        case 'r':
+            NReaders = std::atoi(optarg);
+            break;
+        case 'G':
+            ReadGranularity = static_cast<u32>(parse_size(optarg));
+            break;
+        case 'W':
+            WriteRateMax = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 'L':
+            ReadRate = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 'X':
+            SharedRegion = true;
+            break;
+        case 'O':
+            OpenRateMax = parse_rate(optarg);
+            break;
+        case 'a':
+            OpenArrival = parse_arrival(optarg);
+            break;
+        case 'f':
+            Format = parse_format(optarg);
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+
+    if (argc - optind < 2) {
         fprintf(stderr, "Test PM I/O bandwidth\n");
-        fprintf(stderr, "Usage: %s <NThreads> <Granularity (in bytes)>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-m mode] [-R region] [-s] [-p] [-g] [-o step] [-d path[,path...]] [-S stripe] [-c group]\n"
+                "          [-r readers] [-G read granularity] [-W MB/s] [-L MB/s] [-X]\n"
+                "          [-O ops/s] [-a fixed|poisson] [-f text|csv|json] <NThreads> <Granularity (in bytes)>\n", argv[0]);
+        fprintf(stderr, "  -m  write (default): overwrite PM sequentially\n");
+        fprintf(stderr, "      record: write self-describing records until killed\n");
+        fprintf(stderr, "      verify: after a crash, scan for torn/missing records (same NThreads/Granularity/-R)\n");
+        fprintf(stderr, "      crc, crc-split: write with a CRC32C of every op, fused into the copy or as a separate pass\n");
+        fprintf(stderr, "      memset, memset-avx2: zero PM sequentially with the AVX-512 or AVX2 kernel\n");
+        fprintf(stderr, "      adaptive: pick cached or movnt stores per size class (or take PMEM_MOVNT_THRESHOLD),\n");
+        fprintf(stderr, "                then write with pmem_memcpy_persist\n");
+        fprintf(stderr, "      append, append-staged: small log appends, persisted one by one or per 256B XPLine\n");
+        fprintf(stderr, "      log: NThreads producers append Granularity-byte entries to a PM log with group commit\n");
+        fprintf(stderr, "      log-recover: recovery scan of the log left by log mode\n");
+        fprintf(stderr, "      align: ns/op and bytes/TSC cycle of each kernel over dst/src offsets 0..63 and\n");
+        fprintf(stderr, "             lengths 1..Granularity, checked against memcpy (use -f csv for heatmaps)\n");
+        fprintf(stderr, "      compact: move Granularity-byte ranges within PM over overlapping shifts, backward\n");
+        fprintf(stderr, "               then forward, checking one move in %lu\n", CompactCheckMask + 1);
+        fprintf(stderr, "      mixed: -r random readers and NThreads - r sequential writers; the per-writer rate\n");
+        fprintf(stderr, "             ramps 0, 1/4..1 x -W MB/s, then unlimited, %d s per step\n", MixedStepSecs);
+        fprintf(stderr, "      open: open-loop writes offered at 1/%d..1 x -O ops/s, %d s per step; latency counts\n",
+                OpenLoopSteps, OpenLoopStepSecs);
+        fprintf(stderr, "            from the scheduled issue time\n");
+        fprintf(stderr, "  -R  size of the PM region in use per device (default %lu GB; 32g for records written by client)\n",
+                MemSize >> 30);
+        fprintf(stderr, "  -s  sweep 1..NThreads threads x %uB..Granularity, print a results matrix\n",
+                SweepMinGranularity);
+        fprintf(stderr, "  -p  collect per-thread hardware counters (perf_event)\n");
+        fprintf(stderr, "  -g  write mode: always use the generic kernel, not the fixed-size ones\n");
+        fprintf(stderr, "  -o  align mode: dst/src offset step from %uB on, shorter lengths try every offset\n"
+                "      (default %d)\n", AlignAllOffsets, AlignOffsetStep);
+        fprintf(stderr, "  -d  PM devices or file-backed stand-ins (default %s); with several, threads go round\n", PmDev);
+        fprintf(stderr, "      robin over them, each on a core of its device's socket\n");
+        fprintf(stderr, "  -S  write mode: interleave all devices into one space at this stripe instead\n");
+        fprintf(stderr, "  -c  log mode: entries per group commit (default %u)\n", GroupCommit);
+        fprintf(stderr, "  -r  mixed mode: reader threads (default NThreads / 2)\n");
+        fprintf(stderr, "  -G  mixed mode: read granularity (default Granularity)\n");
+        fprintf(stderr, "  -W  mixed mode: top of the per-writer rate ramp in MB/s (default: only idle/unlimited)\n");
+        fprintf(stderr, "  -L  mixed mode: per-reader rate limit in MB/s (default none)\n");
+        fprintf(stderr, "  -X  mixed mode: read the writers' region instead of a disjoint one\n");
+        fprintf(stderr, "  -O  open mode: top offered rate in ops/s over all threads (k/m suffixes)\n");
+        fprintf(stderr, "  -a  open mode: arrival process (default poisson)\n");
+        fprintf(stderr, "  -f  output format\n");
         exit(-1);
     }
-    NThreads = std::atoi(argv[1]);
+    NThreads = std::atoi(argv[optind]);
+    Granularity = static_cast<u32>(parse_size(argv[optind + 1]));
 
-    size_t l = strlen(argv[2]);
-    Granularity = 1;
-    if (argv[2][l - 1] == 'k' || argv[2][l - 1] == 'K') {
-        Granularity = 1u << 10;
-        argv[2][l - 1] = '\0';
+    if (NThreads < 1 || NThreads > MaxNThreads) {
+        fprintf(stderr, "NThreads must be in [1, %d]\n", MaxNThreads);
+        exit(-1);
     }
-    else if (argv[2][l - 1] == 'm' || argv[2][l - 1] == 'M') {
-        Granularity = 1u << 20;
-        argv[2][l - 1] = '\0';
+    if (NReaders < 0)
+        NReaders = NThreads / 2;
+    if (ReadGranularity == 0)
+        ReadGranularity = Granularity;
+    if (BenchMode == ModeMixed && (NReaders < 1 || NReaders >= NThreads)) {
+        fprintf(stderr, "mixed mode needs at least one reader and one writer\n");
+        exit(-1);
+    }
+    if (BenchMode == ModeOpen && OpenRateMax <= 0) {
+        fprintf(stderr, "open mode needs -O <ops/s>\n");
+        exit(-1);
+    }
+    if (AlignOffsetStep < 1 || AlignOffsetStep > 64) {
+        fprintf(stderr, "align offset step must be 1..64\n");
+        exit(-1);
+    }
+    if (GroupCommit < 1) {
+        fprintf(stderr, "group commit size must be at least 1\n");
+        exit(-1);
+    }
+    bool per_thread = BenchMode != ModeRecord && BenchMode != ModeVerify && BenchMode != ModeLog &&
+                      BenchMode != ModeLogRecover && BenchMode != ModeAlign && BenchMode != ModeMixed;
+    if (split_list(PmDev).size() > 1 && !per_thread) {
+        fprintf(stderr, "mode %s uses a single device\n", ModeNames[BenchMode]);
+        exit(-1);
+    }
+    if (Stripe != 0 && (BenchMode != ModeWrite || Stripe % 64 != 0 || MemSize % Stripe != 0)) {
+        fprintf(stderr, "-S needs write mode and a multiple of 64 dividing the device size\n");
+        exit(-1);
+    }
+    if ((BenchMode == ModeRecord || BenchMode == ModeVerify) &&
+        (Granularity < sizeof(RecordHeader) || Granularity % 8 != 0)) {
+        fprintf(stderr, "records need a Granularity >= %lu and a multiple of 8\n", sizeof(RecordHeader));
+        exit(-1);
+    }
+}
+
+std::atomic_int barrier = 0;
+std::atomic_bool stop = false;
+
+template <class Copy>
+void write_ops(int id, u8 *pm, u8 *local, Copy copy)
+{
+    const size_t Units = (MemSize / Place[id].peers) / Granularity;
+    const size_t Base = Units * Granularity * Place[id].slot;
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        copy((char *)(pm + Base + (i % Units) * Granularity), (char *)local);
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        thpt[id]++;
     }
-    Granularity *= static_cast<u32>(std::atoi(argv[2]));
 }
 
-inline void bind_core(uint16_t core)
+/*
+ * Pick the kernel once: common granularities get a persist<Len> copy with no
+ * length checks, anything else the generic memmove_movnt_avx512f_clwb.
+ */
+bool fixed_kernel(u32 gran)
 {
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(core, &cpuset);
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    switch (gran) {
+    case 64: case 128: case 256: case 512: case 1024: case 4096:
+        return !GenericKernel;
+    default:
+        return false;
+    }
 }
 
-std::atomic_int barrier = 0;
+/*
+ * Appends to a per-thread log. Direct appends are each persisted where they
+ * land; staged ones become durable a whole XPLine at a time.
+ */
+void append_loop(int id, u8 *pm, u8 *local, bool staged)
+{
+    const size_t LogSize = (MemSize / Place[id].peers) / NVM_BLOCK_SIZE * NVM_BLOCK_SIZE;
+    char *log = (char *)pm + LogSize * Place[id].slot;
+    XPLineBuffer buf;
+    buf.init(log, LogSize);
+    size_t tail = 0;
+
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        if (staged) {
+            buf.append(local, Granularity);
+        } else {
+            if (tail + Granularity > LogSize)
+                tail = 0;
+            memmove_movnt_avx512f_clwb(log + tail, (char *)local, Granularity);
+            tail += Granularity;
+        }
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        thpt[id]++;
+    }
+    if (staged)
+        buf.flush();
+}
+
+/*
+ * One producer on its own segment. Commit latency runs from the first append
+ * of a group until the group is durable.
+ */
+void log_loop(int id, u8 *local)
+{
+    LogWriter w;
+    w.init(&Log, id);
+    u64 group_start = 0;
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = rdtsc();
+        w.append(local, Granularity);
+        if (w.pending == 1)     // first of a group, also right after a wrap
+            group_start = t0;
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        if (w.pending == GroupCommit) {
+            w.commit();
+            commit_lat[id].add((u64)((rdtsc() - group_start) / TscPerNs));
+        }
+        thpt[id]++;
+    }
+    w.commit();
+}
+
+/*
+ * In-PM compaction. Each pair of ops takes one live range of a 2 * Granularity
+ * slot, slides it towards the end by a shift (overlapping, so memmove takes
+ * the backward path) and then back (forward path). Shifts cycle through
+ * aligned and unaligned fractions of Granularity, i.e. overlaps of 0..7/8.
+ */
+void compact_loop(int id, u8 *pm, u8 *saved)
+{
+    const size_t Slot = 2 * (size_t)Granularity;
+    const size_t Units = (MemSize / Place[id].peers) / Slot;
+    const size_t Base = Units * Slot * Place[id].slot;
+    const u32 Shifts[] = {
+        std::max(1u, Granularity / 8), std::min(Granularity, Granularity / 4 + 3), std::max(1u, Granularity / 2),
+        std::min(Granularity, Granularity * 3 / 4 + 5), Granularity,
+    };
+    const u64 NShifts = sizeof(Shifts) / sizeof(Shifts[0]);
+
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        char *slot = (char *)pm + Base + ((i >> 1) % Units) * Slot;
+        const u32 shift = Shifts[(i >> 1) % NShifts];
+        char *src = (i & 1) ? slot + shift : slot;
+        char *dst = (i & 1) ? slot : slot + shift;
+
+        const bool check = (i & CompactCheckMask) < 2;
+        if (check)
+            memcpy(saved, src, Granularity);
+
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        memmove_movnt_avx512f_clwb(dst, src, Granularity);
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+
+        if (check && memcmp(saved, dst, Granularity) != 0)
+            compact_errors[id]++;
+        thpt[id]++;
+    }
+}
+
+/*
+ * Sequential writes over the logical space interleaved across all devices.
+ */
+void striped_loop(int id, u8 *local)
+{
+    const size_t Units = (Pm.size() / NThreads) / Granularity;
+    const size_t Base = Units * Granularity * id;
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        Pm.write(Base + (i % Units) * Granularity, (char *)local, Granularity);
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        thpt[id]++;
+    }
+}
+
+void adaptive_loop(int id, u8 *pm, u8 *local)
+{
+    const u32 gran = Granularity;
+    write_ops(id, pm, local, [gran](char *d, const char *s) { pmem_memcpy_persist(d, s, gran); });
+}
+
+void write_loop(int id, u8 *pm, u8 *local)
+{
+#define FIXED(len) \
+    case len: \
+        return write_ops(id, pm, local, [](char *d, const char *s) { persist<len, PersistClwb>(d, s); });
+
+    if (fixed_kernel(Granularity)) {
+        switch (Granularity) {
+        FIXED(64) FIXED(128) FIXED(256) FIXED(512) FIXED(1024) FIXED(4096)
+        }
+    }
+#undef FIXED
+
+    const u32 gran = Granularity;
+    write_ops(id, pm, local, [gran](char *d, const char *s) { memmove_movnt_avx512f_clwb(d, s, gran); });
+}
+
+void crc_loop(int id, u8 *pm, u8 *local, bool fused)
+{
+    const size_t Units = (MemSize / Place[id].peers) / Granularity;
+    const size_t Base = Units * Granularity * Place[id].slot;
+    u32 acc = 0;
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        char *dst = (char *)(pm + Base + (i % Units) * Granularity);
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        if (fused) {
+            acc ^= memmove_movnt_crc_avx512f_clwb(dst, (char *)local, Granularity, 0);
+        } else {
+            acc ^= crc32c(0, local, Granularity);
+            memmove_movnt_avx512f_clwb(dst, (char *)local, Granularity);
+        }
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        thpt[id]++;
+    }
+    crcs[id] = acc;
+}
+
+void memset_loop(int id, u8 *pm, bool avx512)
+{
+    const size_t Units = (MemSize / Place[id].peers) / Granularity;
+    const size_t Base = Units * Granularity * Place[id].slot;
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        char *dst = (char *)(pm + Base + (i % Units) * Granularity);
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        if (avx512)
+            memset_movnt_avx512f_clwb(dst, 0, Granularity);
+        else
+            memset_movnt_avx_clwb(dst, 0, Granularity);
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        thpt[id]++;
+    }
+}
+
+/*
+ * Each record is persisted (movnt + sfence) before the next one is built, so
+ * at a crash at most one record per writer may be torn.
+ */
+void record_loop(int id, u8 *pm, u8 *local)
+{
+    const size_t Units = (MemSize / Place[id].peers) / Granularity;
+    const size_t Base = Units * Granularity * Place[id].slot;
+    const u64 run = record_run_id();
+    for (u64 i = 0; i < NOps && !stop.load(std::memory_order_relaxed); ++i) {
+        const u64 off = Base + (i % Units) * Granularity;
+        record_fill((char *)local, Granularity, run, id, 1, i + 1, off);
+        const bool sample = (i & LatSampleMask) == 0;
+        u64 t0 = sample ? rdtsc() : 0;
+        memmove_movnt_avx512f_clwb((char *)(pm + off), (char *)local, Granularity);
+        if (sample)
+            lat[id].add((u64)((rdtsc() - t0) / TscPerNs));
+        thpt[id]++;
+    }
+}
 
 void worker(int id, u8 *pm)
 {
-    bind_core(id);
+    bind_core(Place[id].core);
     u8 *local = new u8[Granularity];
 
+    PerfGroup pg;
+    bool perf_on = PerfCounting && pg.open();
+
     // Barrier
     barrier.fetch_add(1);
     while (barrier.load() != NThreads + 1);
 
+    if (perf_on)
+        pg.enable();
+
+    switch (BenchMode) {
+    case ModeRecord:
+        record_loop(id, pm, local);
+        break;
+    case ModeCrc:
+    case ModeCrcSplit:
+        crc_loop(id, pm, local, BenchMode == ModeCrc);
+        break;
+    case ModeMemset:
+    case ModeMemsetAvx:
+        memset_loop(id, pm, BenchMode == ModeMemset);
+        break;
+    case ModeAdaptive:
+        adaptive_loop(id, pm, local);
+        break;
+    case ModeAppend:
+    case ModeAppendStaged:
+        append_loop(id, pm, local, BenchMode == ModeAppendStaged);
+        break;
+    case ModeLog:
+        log_loop(id, local);
+        break;
+    case ModeCompact:
+        compact_loop(id, pm, local);
+        break;
+    default:
+        if (Pm.stripe != 0)
+            striped_loop(id, local);
+        else
+            write_loop(id, pm, local);
+        break;
+    }
+
+    if (perf_on) {
+        pg.disable();
+        perf[id] = pg.read();
+    }
+
+    barrier.fetch_sub(1);
+    delete[] local;
+}
+
+/*
+ * Result of scanning one writer's slots after a crash.
+ */
+struct VerifyResult {
+    u64 run = 0;
+    u64 max_seq = 0;
+    u64 inflight = 1;       // records that may be torn or lost, from the writer
+    u64 valid = 0;
+    u64 torn = 0;           // checksum mismatch
+    u64 missing = 0;        // slot holds an older record, or none, than expected
+    u64 misplaced = 0;      // record with a wrong offset/length
+    u64 max_lag = 0;        // max distance of a torn/missing record from max_seq
+};
+
+/*
+ * Two passes over the slots of one writer: find the newest (run, seq), then
+ * check every slot holds exactly the record the writer put there last.
+ */
+void verify_writer(int id, u8 *pm, VerifyResult &res)
+{
+    bind_core(id);
     const size_t Units = (MemSize / NThreads) / Granularity;
     const size_t Base = Units * Granularity * id;
-    for (int i = 0; i < NTests; ++i) {
+    RecordHeader h;
+
+    for (size_t k = 0; k < Units; ++k) {
+        const u64 off = Base + k * Granularity;
+        if (record_check((char *)(pm + off), Granularity, off, h) == RecValid && h.writer == id &&
+            (record_run(h) > res.run || (record_run(h) == res.run && h.seq > res.max_seq))) {
+            res.run = record_run(h);
+            res.inflight = std::max<u64>(h.inflight, 1);
+            res.max_seq = h.seq;
+        }
+    }
+
+    const u64 M = res.max_seq;
+    for (size_t k = 0; k < Units; ++k) {
+        const u64 off = Base + k * Granularity;
+        // newest seq s <= M with (s - 1) % Units == k, 0 if never written
+        const u64 expected = (M >= k + 1) ? M - ((M - 1 - k) % Units) : 0;
+        auto st = record_check((char *)(pm + off), Granularity, off, h);
+        bool ours = st != RecEmpty && record_run(h) == res.run && h.writer == id;
+
+        if (st == RecValid && ours && h.seq == expected) {
+            res.valid++;
+            continue;
+        }
+        if (expected == 0 && !ours)
+            continue;                   // never written in this run
+        if (st == RecTorn && ours) {
+            res.torn++;
+            // a torn record newer than M is the one in flight at the crash
+            u64 lag = h.seq > M ? 0 : M - expected;
+            res.max_lag = std::max(res.max_lag, lag);
+        } else if (st == RecMisplaced) {
+            res.misplaced++;
+        } else {
+            res.missing++;
+            res.max_lag = std::max(res.max_lag, M - expected);
+        }
+    }
+}
+
+int verify(u8 *pm)
+{
+    std::thread workers[MaxNThreads];
+    VerifyResult res[MaxNThreads];
+    for (int i = 0; i < NThreads; ++i)
+        workers[i] = std::thread(verify_writer, i, pm, std::ref(res[i]));
+    for (int i = 0; i < NThreads; ++i)
+        workers[i].join();
+
+    RunInfo info = {"local", PmDev, ModePatterns[ModeVerify], NThreads, Granularity};
+    bool ok = true;
+    for (int i = 0; i < NThreads; ++i) {
+        auto &r = res[i];
+        bool writer_ok = r.misplaced == 0 && r.max_lag < r.inflight;
+        ok = ok && writer_ok;
+        info.record("verify")
+            .add("writer", i).add("run", r.run).add("max_seq", r.max_seq)
+            .add("valid", r.valid).add("torn", r.torn).add("missing", r.missing)
+            .add("misplaced", r.misplaced).add("max_lag", r.max_lag).add("inflight", r.inflight)
+            .add("verdict", writer_ok ? "ok" : "CORRUPT")
+            .print(Format);
+    }
+    return ok ? 0 : 1;
+}
+
+/*
+ * Recover every segment of the log in parallel, one thread per segment.
+ */
+int log_recover(u8 *pm)
+{
+    if (!Log.open((char *)pm)) {
+        fprintf(stderr, "no log on %s, run log mode first\n", PmDev);
+        exit(-1);
+    }
+    std::vector<SegmentRecovery> res(Log.nseg);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (u64 s = 0; s < Log.nseg; ++s)
+        workers.emplace_back([&res, s] {
+            bind_core(s % MaxNThreads);
+            res[s] = log_recover_segment(Log, s);
+        });
+    for (auto &t : workers)
+        t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    RunInfo info = {"local", PmDev, ModePatterns[ModeLogRecover], (int)Log.nseg, 0};
+    u64 entries = 0, bytes = 0, corrupt = 0;
+    for (u64 s = 0; s < Log.nseg; ++s) {
+        auto &r = res[s];
+        entries += r.entries;
+        bytes += r.bytes;
+        corrupt += r.corrupt;
+        info.record("recover")
+            .add("segment", s).add("entries", r.entries).add("bytes", r.bytes).add("max_lsn", r.max_lsn)
+            .add("corrupt", r.corrupt).add("uncommitted", r.uncommitted)
+            .print(Format);
+    }
+    Record r = summary_record(info, secs, entries, bytes, LatHist());
+    r.add("corrupt", corrupt);
+    r.print(Format);
+    return corrupt ? 1 : 0;
+}
+
+/*
+ * Mixed readers and writers. Writers own slices of the first half of the
+ * region; readers pick random ReadGranularity-aligned blocks of the second
+ * half, or of the first with -X. Both classes pace themselves on the TSC
+ * when rate limited. The main thread steps the writer rate limit and
+ * reports each step once the threads are done. Each step is a settle phase
+ * then a measured one; readers record into the histogram of the current
+ * phase, like open mode does per step.
+ */
+std::atomic_int MixedPhase = 0;         // 2 * step, + 1 once measured
+std::vector<double> WriteLimits;        // MB/s per step, 0: idle, < 0: unlimited
+LatHist mixed_lat[MaxNThreads][2 * MixedMaxSteps];
+u64 sink[MaxNThreads];
+
+static inline void pace(u64 &next, u64 bytes, double bytes_per_tick)
+{
+    u64 now = rdtsc();
+    if (next < now)
+        next = now;     // never bank credit while idle or slow
+    next += (u64)(bytes / bytes_per_tick);
+    while (rdtsc() < next);
+}
+
+void mixed_writer(int id, int widx, int nwriters, u8 *pm, u8 *local)
+{
+    bind_core(id);
+    const size_t Units = (MemSize / 2 / nwriters) / Granularity;
+    const size_t Base = Units * Granularity * widx;
+    u64 next = 0;
+    for (u64 i = 0; !stop.load(std::memory_order_relaxed);) {
+        double limit = WriteLimits[MixedPhase.load(std::memory_order_relaxed) / 2];
+        if (limit == 0) {
+            next = 0;
+            continue;
+        }
         memmove_movnt_avx512f_clwb((char *)(pm + Base + (i % Units) * Granularity), (char *)local, Granularity);
+        ++i;
         thpt[id]++;
+        if (limit > 0)
+            pace(next, Granularity, limit * 1e6 / 1e9 / TscPerNs);
     }
+}
 
-    barrier.fetch_sub(1);
+void mixed_reader(int id, u8 *pm, u8 *local)
+{
+    bind_core(id);
+    const u8 *region = pm + (SharedRegion ? 0 : MemSize / 2);
+    const size_t Units = (MemSize / 2) / ReadGranularity;
+    u64 x = 0x9e3779b97f4a7c15ull * (id + 1), next = 0, acc = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const u8 *src = region + (x % Units) * ReadGranularity;
+        u64 t0 = rdtsc();
+        memcpy(local, src, ReadGranularity);
+        u64 t1 = rdtsc();
+        acc += local[0];
+        mixed_lat[id][MixedPhase.load(std::memory_order_relaxed)].add((u64)((t1 - t0) / TscPerNs));
+        thpt[id]++;
+        if (ReadRate > 0)
+            pace(next, ReadGranularity, ReadRate * 1e6 / 1e9 / TscPerNs);
+    }
+    sink[id] = acc;
+}
+
+void mixed(u8 *pm)
+{
+    const int nwriters = NThreads - NReaders;
+    WriteLimits.push_back(0);
+    if (WriteRateMax > 0)
+        for (int q = 1; q <= 4; ++q)
+            WriteLimits.push_back(WriteRateMax * q / 4.0);
+    WriteLimits.push_back(-1);
+
+    std::vector<u8 *> bufs;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NThreads; ++i) {
+        bufs.push_back((u8 *)aligned_alloc(64, std::max(Granularity, ReadGranularity) + 64));
+        if (i < NReaders)
+            threads.emplace_back(mixed_reader, i, pm, bufs[i]);
+        else
+            threads.emplace_back(mixed_writer, i, i - NReaders, nwriters, pm, bufs[i]);
+    }
+
+    double secs[MixedMaxSteps];
+    u64 rd[MixedMaxSteps] = {0}, wr[MixedMaxSteps] = {0};
+    for (size_t step = 0; step < WriteLimits.size(); ++step) {
+        MixedPhase = 2 * step;
+        std::this_thread::sleep_for(std::chrono::seconds(1));       // settle
+        u64 begin[MaxNThreads];
+        for (int i = 0; i < NThreads; ++i)
+            begin[i] = thpt[i];
+        MixedPhase = 2 * step + 1;
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::seconds(MixedStepSecs));
+        secs[step] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (int i = 0; i < NThreads; ++i)
+            (i < NReaders ? rd : wr)[step] += thpt[i] - begin[i];
+    }
+    stop = true;
+    for (auto &t : threads)
+        t.join();
+
+    RunInfo info = {"local", PmDev, ModePatterns[ModeMixed], NThreads, Granularity};
+    for (size_t step = 0; step < WriteLimits.size(); ++step) {
+        LatHist rlat;
+        for (int i = 0; i < NReaders; ++i)
+            rlat.merge(mixed_lat[i][2 * step + 1]);
+        info.record("mixed")
+            .add("step", (u64)step).add("readers", NReaders).add("writers", nwriters)
+            .add("read_granularity", ReadGranularity).add("shared_region", SharedRegion ? "yes" : "no")
+            .add("write_limit_mbps", WriteLimits[step] < 0 ? -1.0 : WriteLimits[step], 0)
+            .add("write_gbps", wr[step] * Granularity / 1e9 / secs[step])
+            .add("read_gbps", rd[step] * ReadGranularity / 1e9 / secs[step])
+            .add("read_p50_ns", rlat.percentile(0.5)).add("read_p90_ns", rlat.percentile(0.9))
+            .add("read_p99_ns", rlat.percentile(0.99)).add("read_p999_ns", rlat.percentile(0.999))
+            .add("read_max_ns", rlat.max)
+            .print(Format);
+    }
+
+    for (u8 *b : bufs)
+        free(b);
+}
+
+/*
+ * Open loop. Workers follow OpenStep, resetting their arrival clock to
+ * their share of the step's rate; each op's latency goes to the histogram
+ * of the step it was scheduled in.
+ */
+std::atomic_int OpenStep = -1;
+LatHist open_lat[MaxNThreads][OpenLoopSteps];
+
+static inline double open_rate(int step)
+{
+    return OpenRateMax * (step + 1) / OpenLoopSteps;
+}
+
+void open_worker(int id, u8 *pm)
+{
+    bind_core(Place[id].core);
+    u8 *local = new u8[Granularity];
+    const size_t Units = (MemSize / Place[id].peers) / Granularity;
+    const size_t Base = Units * Granularity * Place[id].slot;
+    ArrivalClock clk;
+    int step = -1;
+    for (u64 i = 0; !stop.load(std::memory_order_relaxed);) {
+        int s = OpenStep.load(std::memory_order_relaxed);
+        if (s != step) {
+            step = s;
+            if (step >= 0)
+                clk.reset(open_rate(step) / NThreads, OpenArrival, id + 1);
+        }
+        if (step < 0)
+            continue;
+        u64 t = clk.advance();
+        while (rdtsc() < t);
+        memmove_movnt_avx512f_clwb((char *)(pm + Base + (i++ % Units) * Granularity), (char *)local, Granularity);
+        open_lat[id][step].add((u64)((rdtsc() - t) / TscPerNs));
+    }
     delete[] local;
 }
 
+void open_loop()
+{
+    std::thread workers[MaxNThreads];
+    place_workers(NThreads);
+    for (int i = 0; i < NThreads; ++i)
+        workers[i] = std::thread(open_worker, i, (u8 *)Pm.devs[Place[i].dev].base);
+
+    double secs[OpenLoopSteps];
+    for (int step = 0; step < OpenLoopSteps; ++step) {
+        auto start = std::chrono::steady_clock::now();
+        OpenStep = step;
+        std::this_thread::sleep_for(std::chrono::seconds(OpenLoopStepSecs));
+        secs[step] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    stop = true;
+    for (int i = 0; i < NThreads; ++i)
+        workers[i].join();
+
+    RunInfo info = {"local", PmDev, ModePatterns[ModeOpen], NThreads, Granularity};
+    for (int step = 0; step < OpenLoopSteps; ++step) {
+        LatHist all;
+        for (int i = 0; i < NThreads; ++i)
+            all.merge(open_lat[i][step]);
+        open_loop_record(info, OpenArrival == ArrivalFixed ? "fixed" : "poisson", open_rate(step), secs[step],
+                         Granularity, all)
+            .print(Format);
+    }
+}
+
+/*
+ * Alignment sweep. Lengths are 1..8, then the powers of two up to
+ * Granularity and their neighbours, where head and tail paths change.
+ * Lengths below AlignAllOffsets, all head/tail code, try every dst/src
+ * offset; longer ones step by AlignOffsetStep. Each point is timed over
+ * AlignReps copies to different PM slots.
+ */
+static const int AlignReps = 64;
+static const size_t AlignWindow = 64ul << 20;
+
+enum AlignKernel { AlignMovnt = 0, AlignMov, AlignMovntCrc, NAlignKernels };
+static const char *AlignKernelNames[NAlignKernels] = {"movnt", "mov", "movnt-crc"};
+
+static inline void align_copy(int k, char *dst, const char *src, size_t len)
+{
+    switch (k) {
+    case AlignMovnt:
+        memmove_movnt_avx512f_clwb(dst, src, len);
+        break;
+    case AlignMov:
+        memmove_mov_avx512f_clwb(dst, src, len);
+        break;
+    default:
+        crcs[0] ^= memmove_movnt_crc_avx512f_clwb(dst, src, len, 0);
+        break;
+    }
+}
+
+int align_sweep(u8 *pm)
+{
+    bind_core(0);
+    std::vector<u32> lens;
+    for (u32 l = 1; l <= std::min(Granularity, 8u); ++l)
+        lens.push_back(l);
+    for (u32 l = 16; l <= Granularity; l *= 2) {
+        lens.push_back(l - 1);
+        lens.push_back(l);
+        if (l + 1 <= Granularity)
+            lens.push_back(l + 1);
+    }
+
+    const size_t Slot = ((size_t)Granularity + 64 + 4095) / 4096 * 4096;
+    const size_t Slots = std::min(AlignWindow, MemSize) / Slot;
+    char *src = (char *)aligned_alloc(64, Slot);
+    char *expect = (char *)aligned_alloc(64, Slot);
+    for (size_t i = 0; i < Slot; ++i)
+        src[i] = (char)(i * 131 + 7);
+
+    memset_movnt_avx512f_clwb((char *)pm, 0, Slots * Slot);     // fault the window in
+
+    RunInfo info = {"local", PmDev, ModePatterns[ModeAlign], 1, 0};
+    u64 errors = 0;
+    for (int k = 0; k < NAlignKernels; ++k)
+        for (u32 len : lens) {
+            const int step = len < AlignAllOffsets ? 1 : AlignOffsetStep;
+            for (int doff = 0; doff < 64; doff += step)
+                for (int soff = 0; soff < 64; soff += step) {
+                    u64 t0 = rdtsc();
+                    for (int r = 0; r < AlignReps; ++r)
+                        align_copy(k, (char *)pm + (r % Slots) * Slot + doff, src + soff, len);
+                    double cycles = (double)(rdtsc() - t0) / AlignReps;
+
+                    // check one copy, guard bytes included
+                    char *dst = (char *)pm + (AlignReps % Slots) * Slot;
+                    memset(dst, 0xee, Slot);
+                    memset(expect, 0xee, Slot);
+                    memcpy(expect + doff, src + soff, len);
+                    align_copy(k, dst + doff, src + soff, len);
+                    bool ok = memcmp(dst, expect, Slot) == 0;
+                    errors += !ok;
+
+                    info.granularity = len;
+                    info.record("align")
+                        .add("kernel", AlignKernelNames[k]).add("dst_off", doff).add("src_off", soff)
+                        .add("ns", cycles / TscPerNs).add("bytes_per_cycle", len / cycles, 4)
+                        .add("ok", ok ? "yes" : "NO")
+                        .print(Format);
+                }
+        }
+
+    free(src);
+    free(expect);
+    if (errors)
+        fprintf(stderr, "%lu sweep points differ from memcpy\n", errors);
+    return errors ? 1 : 0;
+}
+
+/*
+ * Time cached stores + clwb against movnt for each power-of-two size on the
+ * start of the region, and let each size class of Movnt_classes use the
+ * faster one. Shorter copies than measured stay cached, longer ones take
+ * movnt.
+ * Runs on a short-lived thread bound to core 0, as the main thread keeps its
+ * own core off the workers'.
+ */
+static const u32 CalibMinSize = 64;
+static const u32 CalibMaxSize = 16384;
+static const size_t CalibWindow = 256ul << 20;
+static const int CalibReps = 4096;
+
+void calibrate_movnt_on_core0(u8 *pm)
+{
+    bind_core(0);
+    char *src = (char *)aligned_alloc(64, CalibMaxSize);
+    memset(src, 0x5a, CalibMaxSize);
+
+    auto time_ns = [&](u32 size, bool movnt) {
+        const size_t slots = CalibWindow / size;
+        u64 t0 = rdtsc();
+        for (int r = 0; r < CalibReps; ++r) {
+            char *dst = (char *)pm + (r % slots) * size;
+            if (movnt)
+                memmove_movnt_avx512f_clwb(dst, src, size);
+            else
+                memmove_mov_avx512f_clwb(dst, src, size);
+        }
+        return (rdtsc() - t0) / TscPerNs / CalibReps;
+    };
+
+    u64 classes = ~0ull << movnt_class(CalibMaxSize * 2);
+    RunInfo info = {"local", PmDev, "calibrate-movnt", 1, 0};
+    for (u32 size = CalibMinSize; size <= CalibMaxSize; size *= 2) {
+        time_ns(size, false);       // warm up the window
+        double mov = time_ns(size, false);
+        double movnt = time_ns(size, true);
+        if (movnt <= mov)
+            classes |= 1ull << movnt_class(size);
+        info.granularity = size;
+        info.record("calibration").add("mov_ns", mov).add("movnt_ns", movnt)
+            .add("use", movnt <= mov ? "movnt" : "mov").print(Format);
+    }
+    Movnt_classes = classes;
+    free(src);
+}
+
+void calibrate_movnt(u8 *pm)
+{
+    std::thread(calibrate_movnt_on_core0, pm).join();
+}
+
+/*
+ * Run one sweep point on the already mapped PM and return its bandwidth.
+ */
+double run_point(int nthreads, u32 gran)
+{
+    NThreads = nthreads;
+    Granularity = gran;
+    NOps = UINT64_MAX;
+    memset(thpt, 0, sizeof(thpt));
+    stop = false;
+    barrier = 0;
+
+    std::thread workers[MaxNThreads];
+    place_workers(NThreads);
+    for (int i = 0; i < NThreads; ++i)
+        workers[i] = std::thread(worker, i, (u8 *)Pm.devs[Place[i].dev].base);
+
+    barrier.fetch_add(1);
+    while (barrier.load() != NThreads + 1);
+
+    auto total = [] {
+        u64 tot = 0;
+        for (int j = 0; j < NThreads; ++j)
+            tot += thpt[j];
+        return tot;
+    };
+
+    std::this_thread::sleep_for(std::chrono::seconds(SweepWarmupSecs));
+    u64 ops_begin = total();
+    auto start_time = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds(SweepMeasureSecs));
+    u64 ops_end = total();
+    auto end_time = std::chrono::steady_clock::now();
+
+    stop = true;
+    for (int i = 0; i < NThreads; ++i)
+        workers[i].join();
+
+    double secs = std::chrono::duration<double>(end_time - start_time).count();
+    return (ops_end - ops_begin) * Granularity / 1e9 / secs;
+}
+
 int main(int argc, char **argv)
 {
     parse_inargs(argc, argv);
     bind_core(MaxNThreads);
+    TscPerNs = tsc_per_ns();
 
-    int fd = open("/dev/dax0.0", O_RDWR);
-    if (fd < 0) {
-        fprintf(stderr, "cannot open %s: %s\n", PmDev, strerror(errno));
-        exit(-1);
+    Pm.open(PmDev, MemSize);
+    Pm.stripe = Stripe;
+    void *pmbuf = Pm.devs[0].base;
+
+    if (BenchMode == ModeVerify)
+        return verify((u8 *)pmbuf);
+    if (BenchMode == ModeLogRecover)
+        return log_recover((u8 *)pmbuf);
+    if (BenchMode == ModeAlign)
+        return align_sweep((u8 *)pmbuf);
+    if (BenchMode == ModeMixed) {
+        mixed((u8 *)pmbuf);
+        return 0;
     }
-    void *pmbuf = mmap(nullptr, MemSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (pmbuf == (void *)-1) {
-        fprintf(stderr, "cannot mmap: %s\n", strerror(errno));
-        exit(-1);
+    if (BenchMode == ModeOpen) {
+        open_loop();
+        return 0;
+    }
+    if (BenchMode == ModeLog) {
+        Log.format((char *)pmbuf, MemSize, NThreads);
+        if (entry_size(Granularity) * GroupCommit > Log.seg_size / 2) {
+            fprintf(stderr, "log segments too small for groups of %u entries\n", GroupCommit);
+            exit(-1);
+        }
+    }
+    if (BenchMode == ModeRecord)
+        NOps = UINT64_MAX;
+    if (BenchMode == ModeAdaptive) {
+        bool from_env = pmem_movnt_threshold_env();
+        if (!from_env)
+            calibrate_movnt((u8 *)pmbuf);
+        char classes[32];
+        snprintf(classes, sizeof(classes), "%#lx", Movnt_classes);
+        Record r;
+        r.add("type", "crossover").add("bench", "local").add("backend", PmDev)
+         .add("movnt_classes", classes).add("source", from_env ? "env" : "calibrated")
+         .add("granularity_uses", Movnt_classes >> movnt_class(Granularity) & 1 ? "movnt" : "mov");
+        add_run_meta(r);
+        r.print(Format);
+    }
+
+    if (Sweep) {
+        auto m = run_sweep(NThreads, Granularity, [](int t, u32 g) {
+            return run_point(t, g);
+        });
+        print_sweep(m, Format);
+        return 0;
     }
 
+    RunInfo info = {"local", PmDev, ModePatterns[BenchMode], NThreads, Granularity};
+
     std::thread workers[MaxNThreads];
+    place_workers(NThreads);
     for (int i = 0; i < NThreads; ++i)
-        workers[i] = std::thread(worker, i, (u8 *)pmbuf);
+        workers[i] = std::thread(worker, i, (u8 *)Pm.devs[Place[i].dev].base);
 
     barrier.fetch_add(1);
     while (barrier.load() != NThreads + 1);
 
     auto start_time = std::chrono::steady_clock::now();
+    auto run_start = start_time;
 
     u64 recent = 0;
     for (int i = 0; barrier.load(std::memory_order_relaxed) > 1; ++i) {
@@ -122,12 +1142,42 @@ int main(int argc, char **argv)
         u64 delta = tot - recent;
         recent = tot;
 
-        double thpt_in_gb = (delta * Granularity) / 1e9;
-        printf("%.3lf GB/s\n", thpt_in_gb);
+        report_interval(info, Format, i, 1.0, delta, delta * Granularity);
     }
 
     for (int i = 0; i < NThreads; ++i)
         workers[i].join();
+    auto run_end = std::chrono::steady_clock::now();
+
+    u64 ops = 0;
+    LatHist all;
+    PerfCounters counters;
+    for (int j = 0; j < NThreads; ++j) {
+        ops += thpt[j];
+        all.merge(lat[j]);
+        counters.merge(perf[j]);
+    }
+    double secs = std::chrono::duration<double>(run_end - run_start).count();
+    Record summary = summary_record(info, secs, ops, ops * Granularity, all);
+    if (BenchMode == ModeWrite)
+        summary.add("kernel", fixed_kernel(Granularity) ? "fixed" : "generic");
+    u64 errors = 0;
+    if (BenchMode == ModeCompact) {
+        for (int j = 0; j < NThreads; ++j)
+            errors += compact_errors[j];
+        summary.add("errors", errors);
+    }
+    if (BenchMode == ModeLog) {
+        LatHist commits;
+        for (int j = 0; j < NThreads; ++j)
+            commits.merge(commit_lat[j]);
+        summary.add("group", GroupCommit).add("commits", commits.total)
+               .add("commit_p50_ns", commits.percentile(0.5)).add("commit_p99_ns", commits.percentile(0.99))
+               .add("commit_p999_ns", commits.percentile(0.999)).add("commit_max_ns", commits.max);
+    }
+    if (PerfCounting)
+        add_perf_fields(summary, counters, ops, ops * Granularity);
+    summary.print(Format);
 
-    return 0;
+    return errors ? 1 : 0;
 }
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <immintrin.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #define force_inline __attribute__((always_inline)) inline
 #define NORETURN __attribute__((noreturn))
@@ -626,4 +627,472 @@ static force_inline void memmove_movnt_avx512f_clwb(char *dest, const char *src,
                         barrier_after_ntstores);
 }
 
+/*
+ * crc32c_u8 / crc32c_64b -- fold bytes, or one 64B line held in a zmm
+ * register, into a (pre-inverted) CRC32C state
+ */
+static force_inline uint64_t crc32c_u8(uint64_t crc, const char *src,
+                                       size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    crc = _mm_crc32_u8((uint32_t)crc, (uint8_t)src[i]);
+  return crc;
+}
+
+static force_inline uint64_t crc32c_64b(uint64_t crc, __m512i zmm) {
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[0]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[1]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[2]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[3]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[4]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[5]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[6]);
+  crc = _mm_crc32_u64(crc, (uint64_t)zmm[7]);
+  return crc;
+}
+
+/*
+ * memmove_movnt4x64b_crc / memmove_movnt1x64b_crc -- like memmove_movnt*x64b,
+ * and fold the loaded lines into the CRC straight from the zmm registers,
+ * so the checksum never reads the source a second time.
+ */
+static force_inline uint64_t memmove_movnt4x64b_crc(char *dest,
+                                                    const char *src,
+                                                    uint64_t crc) {
+  __m512i zmm0 = mm512_loadu_si512(src, 0);
+  __m512i zmm1 = mm512_loadu_si512(src, 1);
+  __m512i zmm2 = mm512_loadu_si512(src, 2);
+  __m512i zmm3 = mm512_loadu_si512(src, 3);
+
+  mm512_stream_si512(dest, 0, zmm0);
+  mm512_stream_si512(dest, 1, zmm1);
+  mm512_stream_si512(dest, 2, zmm2);
+  mm512_stream_si512(dest, 3, zmm3);
+
+  crc = crc32c_64b(crc, zmm0);
+  crc = crc32c_64b(crc, zmm1);
+  crc = crc32c_64b(crc, zmm2);
+  crc = crc32c_64b(crc, zmm3);
+  return crc;
+}
+
+static force_inline uint64_t memmove_movnt1x64b_crc(char *dest,
+                                                    const char *src,
+                                                    uint64_t crc) {
+  __m512i zmm0 = mm512_loadu_si512(src, 0);
+
+  mm512_stream_si512(dest, 0, zmm0);
+
+  return crc32c_64b(crc, zmm0);
+}
+
+static force_inline uint32_t memmove_movnt_crc_avx512f(char *dest,
+                                                       const char *src,
+                                                       size_t len, uint32_t crc,
+                                                       flush_fn flush,
+                                                       barrier_fn barrier) {
+  /* the small-copy helpers assume len > 0 */
+  if (len == 0)
+    return crc;
+
+  uint64_t c = ~crc;
+
+  size_t cnt = (uint64_t)dest & 63;
+  if (cnt > 0) {
+    cnt = 64 - cnt;
+
+    if (cnt > len)
+      cnt = len;
+
+    memmove_small_avx512f(dest, src, cnt, flush);
+    c = crc32c_u8(c, src, cnt);
+
+    dest += cnt;
+    src += cnt;
+    len -= cnt;
+  }
+
+  while (len >= 4 * 64) {
+    c = memmove_movnt4x64b_crc(dest, src, c);
+    dest += 4 * 64;
+    src += 4 * 64;
+    len -= 4 * 64;
+  }
+
+  while (len >= 1 * 64) {
+    c = memmove_movnt1x64b_crc(dest, src, c);
+    dest += 1 * 64;
+    src += 1 * 64;
+    len -= 1 * 64;
+  }
+
+  if (len > 0) {
+    memmove_small_avx512f(dest, src, len, flush);
+    c = crc32c_u8(c, src, len);
+  }
+
+  avx_zeroupper();
+  barrier();
+  return ~(uint32_t)c;
+}
+
+static force_inline uint32_t memmove_movnt_crc_avx512f_noflush(char *dest,
+                                                               const char *src,
+                                                               size_t len,
+                                                               uint32_t crc) {
+  return memmove_movnt_crc_avx512f(dest, src, len, crc, noflush,
+                                   barrier_after_ntstores);
+}
+
+static force_inline uint32_t memmove_movnt_crc_avx512f_clwb(char *dest,
+                                                            const char *src,
+                                                            size_t len,
+                                                            uint32_t crc) {
+  return memmove_movnt_crc_avx512f(dest, src, len, crc, flush_clwb_nolog,
+                                   barrier_after_ntstores);
+}
+
+/*
+ * memset_small_avx -- set up to 64 bytes with regular stores and flush them
+ */
+static force_inline void memset_small_avx(char *dest, __m256i ymm, size_t len,
+                                          flush_fn flush) {
+  assert(len <= 64);
+  char *d = dest;
+  size_t l = len;
+
+  if (l > 32) {
+    /* 33..64 */
+    _mm256_storeu_si256((__m256i *)d, ymm);
+    _mm256_storeu_si256((__m256i *)(d + l - 32), ymm);
+    goto out;
+  }
+
+  if (l > 16) {
+    /* 17..32 */
+    __m128i xmm = _mm256_extracti128_si256(ymm, 0);
+
+    _mm_storeu_si128((__m128i *)d, xmm);
+    _mm_storeu_si128((__m128i *)(d + l - 16), xmm);
+    goto out;
+  }
+
+  {
+    uint64_t d8 = (uint64_t)_mm256_extract_epi64(ymm, 0);
+
+    if (l > 8) {
+      /* 9..16 */
+      *(ua_uint64_t *)d = d8;
+      *(ua_uint64_t *)(d + l - 8) = d8;
+      goto out;
+    }
+
+    /* 1..8 */
+    for (size_t i = 0; i < l; ++i)
+      d[i] = (char)d8;
+  }
+
+out:
+  flush(dest, len);
+}
+
+static force_inline void memset_movnt4x64b(char *dest, __m512i zmm) {
+  mm512_stream_si512(dest, 0, zmm);
+  mm512_stream_si512(dest, 1, zmm);
+  mm512_stream_si512(dest, 2, zmm);
+  mm512_stream_si512(dest, 3, zmm);
+}
+
+static force_inline void memset_movnt1x64b(char *dest, __m512i zmm) {
+  mm512_stream_si512(dest, 0, zmm);
+}
+
+static force_inline void memset_movnt4x64b_avx(char *dest, __m256i ymm) {
+  __m256i *d = (__m256i *)dest;
+
+  _mm256_stream_si256(d + 0, ymm);
+  _mm256_stream_si256(d + 1, ymm);
+  _mm256_stream_si256(d + 2, ymm);
+  _mm256_stream_si256(d + 3, ymm);
+  _mm256_stream_si256(d + 4, ymm);
+  _mm256_stream_si256(d + 5, ymm);
+  _mm256_stream_si256(d + 6, ymm);
+  _mm256_stream_si256(d + 7, ymm);
+}
+
+static force_inline void memset_movnt1x64b_avx(char *dest, __m256i ymm) {
+  __m256i *d = (__m256i *)dest;
+
+  _mm256_stream_si256(d + 0, ymm);
+  _mm256_stream_si256(d + 1, ymm);
+}
+
+/*
+ * memset_movnt_avx512f / memset_movnt_avx -- fill with non-temporal stores,
+ * so zeroing PM costs no load bandwidth. The unaligned head and tail go
+ * through regular stores and `flush`.
+ */
+static force_inline void memset_movnt_avx512f(char *dest, int c, size_t len,
+                                              flush_fn flush,
+                                              barrier_fn barrier) {
+  /* the small-set helper assumes len > 0 */
+  if (len == 0)
+    return;
+
+  __m512i zmm = _mm512_set1_epi8((char)c);
+  __m256i ymm = _mm256_set1_epi8((char)c);
+
+  size_t cnt = (uint64_t)dest & 63;
+  if (cnt > 0) {
+    cnt = 64 - cnt;
+
+    if (cnt > len)
+      cnt = len;
+
+    memset_small_avx(dest, ymm, cnt, flush);
+
+    dest += cnt;
+    len -= cnt;
+  }
+
+  while (len >= 4 * 64) {
+    memset_movnt4x64b(dest, zmm);
+    dest += 4 * 64;
+    len -= 4 * 64;
+  }
+
+  while (len >= 1 * 64) {
+    memset_movnt1x64b(dest, zmm);
+    dest += 1 * 64;
+    len -= 1 * 64;
+  }
+
+  if (len > 0)
+    memset_small_avx(dest, ymm, len, flush);
+
+  avx_zeroupper();
+  barrier();
+}
+
+static force_inline void memset_movnt_avx(char *dest, int c, size_t len,
+                                          flush_fn flush, barrier_fn barrier) {
+  if (len == 0)
+    return;
+
+  __m256i ymm = _mm256_set1_epi8((char)c);
+
+  size_t cnt = (uint64_t)dest & 63;
+  if (cnt > 0) {
+    cnt = 64 - cnt;
+
+    if (cnt > len)
+      cnt = len;
+
+    memset_small_avx(dest, ymm, cnt, flush);
+
+    dest += cnt;
+    len -= cnt;
+  }
+
+  while (len >= 4 * 64) {
+    memset_movnt4x64b_avx(dest, ymm);
+    dest += 4 * 64;
+    len -= 4 * 64;
+  }
+
+  while (len >= 1 * 64) {
+    memset_movnt1x64b_avx(dest, ymm);
+    dest += 1 * 64;
+    len -= 1 * 64;
+  }
+
+  if (len > 0)
+    memset_small_avx(dest, ymm, len, flush);
+
+  avx_zeroupper();
+  barrier();
+}
+
+static force_inline void memset_movnt_avx512f_noflush(char *dest, int c,
+                                                      size_t len) {
+  memset_movnt_avx512f(dest, c, len, noflush, barrier_after_ntstores);
+}
+
+static force_inline void memset_movnt_avx512f_clwb(char *dest, int c,
+                                                   size_t len) {
+  memset_movnt_avx512f(dest, c, len, flush_clwb_nolog, barrier_after_ntstores);
+}
+
+static force_inline void memset_movnt_avx_noflush(char *dest, int c,
+                                                  size_t len) {
+  memset_movnt_avx(dest, c, len, noflush, barrier_after_ntstores);
+}
+
+static force_inline void memset_movnt_avx_clwb(char *dest, int c, size_t len) {
+  memset_movnt_avx(dest, c, len, flush_clwb_nolog, barrier_after_ntstores);
+}
+
+/*
+ * persist<Len, Policy> -- memmove_movnt_avx512f_fw for a length known at
+ * compile time. dest must be 64B aligned, as PM slots are, so there is no
+ * head to align and the 64B blocks unroll into straight-line code; only a
+ * Len % 64 tail goes through memmove_small_avx and Policy::flush.
+ */
+struct PersistNoflush {
+  static force_inline void flush(const void *addr, size_t len) {
+    noflush(addr, len);
+  }
+  static force_inline void barrier() { barrier_after_ntstores(); }
+};
+
+struct PersistClwb {
+  static force_inline void flush(const void *addr, size_t len) {
+    flush_clwb_nolog(addr, len);
+  }
+  static force_inline void barrier() { barrier_after_ntstores(); }
+};
+
+template <size_t Len, class Policy>
+static force_inline void persist_blocks(char *dest, const char *src) {
+  if constexpr (Len >= 32 * 64) {
+    memmove_movnt32x64b(dest, src);
+    persist_blocks<Len - 32 * 64, Policy>(dest + 32 * 64, src + 32 * 64);
+  } else if constexpr (Len >= 16 * 64) {
+    memmove_movnt16x64b(dest, src);
+    persist_blocks<Len - 16 * 64, Policy>(dest + 16 * 64, src + 16 * 64);
+  } else if constexpr (Len >= 8 * 64) {
+    memmove_movnt8x64b(dest, src);
+    persist_blocks<Len - 8 * 64, Policy>(dest + 8 * 64, src + 8 * 64);
+  } else if constexpr (Len >= 4 * 64) {
+    memmove_movnt4x64b(dest, src);
+    persist_blocks<Len - 4 * 64, Policy>(dest + 4 * 64, src + 4 * 64);
+  } else if constexpr (Len >= 2 * 64) {
+    memmove_movnt2x64b(dest, src);
+    persist_blocks<Len - 2 * 64, Policy>(dest + 2 * 64, src + 2 * 64);
+  } else if constexpr (Len >= 1 * 64) {
+    memmove_movnt1x64b(dest, src);
+    persist_blocks<Len - 1 * 64, Policy>(dest + 1 * 64, src + 1 * 64);
+  } else if constexpr (Len > 0) {
+    memmove_small_avx(dest, src, Len, Policy::flush);
+  }
+}
+
+template <size_t Len, class Policy>
+static force_inline void persist(char *dest, const char *src) {
+  assert(((uintptr_t)dest & 63) == 0);
+
+  persist_blocks<Len, Policy>(dest, src);
+  avx_zeroupper();
+  Policy::barrier();
+}
+
+/*
+ * memmove_mov_avx512f -- forward copy with regular (cached) stores, each
+ * 4x64B block flushed right after it is written
+ */
+static force_inline void memmove_mov_avx512f(char *dest, const char *src,
+                                             size_t len, flush_fn flush,
+                                             barrier_fn barrier) {
+  if (len == 0)
+    return;
+
+  size_t cnt = (uint64_t)dest & 63;
+  if (cnt > 0) {
+    cnt = 64 - cnt;
+
+    if (cnt > len)
+      cnt = len;
+
+    memmove_small_avx512f(dest, src, cnt, flush);
+
+    dest += cnt;
+    src += cnt;
+    len -= cnt;
+  }
+
+  while (len >= 4 * 64) {
+    __m512i zmm0 = mm512_loadu_si512(src, 0);
+    __m512i zmm1 = mm512_loadu_si512(src, 1);
+    __m512i zmm2 = mm512_loadu_si512(src, 2);
+    __m512i zmm3 = mm512_loadu_si512(src, 3);
+
+    _mm512_store_si512((__m512i *)dest + 0, zmm0);
+    _mm512_store_si512((__m512i *)dest + 1, zmm1);
+    _mm512_store_si512((__m512i *)dest + 2, zmm2);
+    _mm512_store_si512((__m512i *)dest + 3, zmm3);
+    flush(dest, 4 * 64);
+
+    dest += 4 * 64;
+    src += 4 * 64;
+    len -= 4 * 64;
+  }
+
+  while (len >= 1 * 64) {
+    __m512i zmm0 = mm512_loadu_si512(src, 0);
+
+    _mm512_store_si512((__m512i *)dest, zmm0);
+    flush(dest, 64);
+
+    dest += 1 * 64;
+    src += 1 * 64;
+    len -= 1 * 64;
+  }
+
+  if (len > 0)
+    memmove_small_avx512f(dest, src, len, flush);
+
+  avx_zeroupper();
+  barrier();
+}
+
+static force_inline void memmove_mov_avx512f_clwb(char *dest, const char *src,
+                                                  size_t len) {
+  memmove_mov_avx512f(dest, src, len, flush_clwb_nolog, barrier_after_ntstores);
+}
+
+/*
+ * Copies use cached stores + clwb or movnt by size class, class k holding
+ * lengths [2^k, 2^(k+1)): the crossover is not always a single point, e.g.
+ * when movnt only wins once a copy spans whole XPLines. Bit k of
+ * Movnt_classes set means movnt. The default is PMDK's threshold of 256;
+ * callers calibrate each class at startup and PMEM_MOVNT_THRESHOLD
+ * overrides with a single threshold.
+ */
+static uint64_t Movnt_classes = ~0ull << 8;
+
+static inline int movnt_class(size_t len) { return len ? 63 - __builtin_clzll(len) : 0; }
+
+/*
+ * pmem_movnt_threshold -- movnt for lengths from t on, t rounded up to a
+ * power of two
+ */
+static inline void pmem_movnt_threshold(size_t t) {
+  int k = t <= 1 ? 0 : movnt_class(t - 1) + 1;
+  Movnt_classes = k >= 64 ? 0 : ~0ull << k;
+}
+
+/*
+ * pmem_movnt_threshold_env -- apply PMEM_MOVNT_THRESHOLD, returns 1 if set
+ */
+static inline int pmem_movnt_threshold_env(void) {
+  const char *e = getenv("PMEM_MOVNT_THRESHOLD");
+  if (e == NULL)
+    return 0;
+
+  char *end;
+  long long v = strtoll(e, &end, 0);
+  if (end == e || *end != '\0' || v < 0)
+    return 0;
+
+  pmem_movnt_threshold((size_t)v);
+  return 1;
+}
+
+static force_inline void pmem_memcpy_persist(char *dest, const char *src,
+                                             size_t len) {
+  if (Movnt_classes >> movnt_class(len) & 1)
+    memmove_movnt_avx512f_clwb(dest, src, len);
+  else
+    memmove_mov_avx512f_clwb(dest, src, len);
+}
+
 #endif // _PERSIST_H_
\ No newline at end of file
@@ -0,0 +1,191 @@
+#if !defined(PMDEV_H)
+#define PMDEV_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "persist.h"
+
+/*
+ * PM spread over several devices, typically one dax namespace per socket
+ * ("/dev/dax0.0,/dev/dax1.0"). Workers either use a device of their own
+ * socket, or a logical address space interleaved across all devices at a
+ * fixed stripe.
+ */
+
+static inline std::vector<std::string> split_list(const char *s)
+{
+    std::vector<std::string> res;
+    std::string cur;
+    for (; *s; ++s) {
+        if (*s == ',') {
+            if (!cur.empty())
+                res.push_back(cur);
+            cur.clear();
+        } else {
+            cur += *s;
+        }
+    }
+    if (!cur.empty())
+        res.push_back(cur);
+    return res;
+}
+
+static inline int read_int_file(const std::string &path, int dflt)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == nullptr)
+        return dflt;
+    int v = dflt;
+    if (fscanf(f, "%d", &v) != 1)
+        v = dflt;
+    fclose(f);
+    return v;
+}
+
+/*
+ * NUMA node of a device-dax namespace, -1 for anything else (e.g. a file).
+ */
+static inline int dax_numa_node(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    if (name.compare(0, 3, "dax") != 0)
+        return -1;
+    std::string dir = "/sys/bus/dax/devices/" + name + "/";
+    int node = read_int_file(dir + "target_node", -1);
+    return node >= 0 ? node : read_int_file(dir + "numa_node", -1);
+}
+
+/*
+ * CPUs of a NUMA node, from its cpulist ("0-17,36-53"); empty if unknown.
+ */
+static inline std::vector<int> node_cpus(int node)
+{
+    std::vector<int> res;
+    if (node < 0)
+        return res;
+    std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == nullptr)
+        return res;
+    char line[4096];
+    if (fgets(line, sizeof(line), f) != nullptr) {
+        for (char *p = line; *p >= '0' && *p <= '9';) {
+            int lo = strtol(p, &p, 10), hi = lo;
+            if (*p == '-')
+                hi = strtol(p + 1, &p, 10);
+            for (int c = lo; c <= hi; ++c)
+                res.push_back(c);
+            if (*p == ',')
+                ++p;
+        }
+    }
+    fclose(f);
+    return res;
+}
+
+static inline char *map_pm(const char *path, size_t size)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    void *buf = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buf == (void *)-1) {
+        fprintf(stderr, "cannot mmap %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    close(fd);
+    return (char *)buf;
+}
+
+struct PmDevice {
+    std::string path;
+    int node;           // NUMA node, -1 if unknown
+    char *base;
+};
+
+struct PmPlace {
+    int core;           // core to bind the worker to
+    int dev;            // device it writes to
+    int slot;           // its share of the device, of peers
+    int peers;          // workers on the device
+};
+
+struct PmBackend {
+    std::vector<PmDevice> devs;
+    size_t dev_size = 0;        // bytes mapped per device
+    size_t stripe = 0;          // interleave unit of the logical space, 0: none
+
+    void open(const char *list, size_t size)
+    {
+        dev_size = size;
+        for (auto &p : split_list(list))
+            devs.push_back({p, dax_numa_node(p), map_pm(p.c_str(), size)});
+        if (devs.empty()) {
+            fprintf(stderr, "no PM device given\n");
+            exit(-1);
+        }
+    }
+
+    /*
+     * Placement of worker id of n: devices round robin by id, like the
+     * client spreads its threads over the server's MRs, each device split
+     * evenly among its workers. The worker runs on a core of its device's
+     * node other than `reserved` (the main thread's), or on core id when
+     * the node or its cores are unknown.
+     */
+    PmPlace place(int id, int n, int reserved) const
+    {
+        const int ndev = devs.size();
+        PmPlace p;
+        p.dev = id % ndev;
+        p.slot = id / ndev;
+        p.peers = (n - p.dev + ndev - 1) / ndev;
+        p.core = id;
+        std::vector<int> cpus = node_cpus(devs[p.dev].node);
+        cpus.erase(std::remove(cpus.begin(), cpus.end(), reserved), cpus.end());
+        if ((int)cpus.size() > p.slot)
+            p.core = cpus[p.slot];
+        return p;
+    }
+
+    size_t size() const { return dev_size * devs.size(); }
+
+    /*
+     * Logical offset -> address. Stripe i lives on device i % ndev.
+     */
+    char *addr(uint64_t off) const
+    {
+        if (stripe == 0)
+            return devs[0].base + off;
+        uint64_t s = off / stripe;
+        return devs[s % devs.size()].base + (s / devs.size()) * stripe + off % stripe;
+    }
+
+    /*
+     * Persist `len` bytes at a logical offset, split at stripe boundaries.
+     */
+    void write(uint64_t off, const char *src, size_t len) const
+    {
+        while (len > 0) {
+            size_t n = stripe == 0 ? len : std::min(len, stripe - off % stripe);
+            memmove_movnt_avx512f_clwb(addr(off), src, n);
+            off += n;
+            src += n;
+            len -= n;
+        }
+    }
+};
+
+#endif // PMDEV_H
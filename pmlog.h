@@ -0,0 +1,224 @@
+#if !defined(PMLOG_H)
+#define PMLOG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#include "persist.h"
+#include "record.h"
+
+/*
+ * Minimal append-only log on PM.
+ *
+ * The region starts with a LogHeader and is split into one segment per
+ * producer. A segment starts with a SegmentHeader holding the persisted tail
+ * and a generation that is bumped when the segment wraps around; entries
+ * follow, each an EntryHeader plus payload padded to 8 bytes. Producers
+ * append without fencing and make a group of entries durable with commit():
+ * one sfence for the entries, then the new tail is persisted. Recovery trusts
+ * a segment up to its persisted tail and checks every entry there.
+ */
+
+static const uint64_t LogMagic = 0x474f4c4d50ull;        // "PMLOG"
+static const uint32_t EntryMagic = 0x544e45;             // "ENT"
+
+struct LogHeader {
+    uint64_t magic;
+    uint64_t nseg;
+    uint64_t seg_size;          // bytes per segment, header included
+};
+
+struct alignas(NVM_BLOCK_SIZE) SegmentHeader {
+    uint64_t tail;              // committed bytes after the segment header
+    uint64_t gen;
+};
+
+struct EntryHeader {
+    uint32_t magic;
+    uint32_t len;               // payload bytes
+    uint64_t lsn;               // log-wide sequence number
+    uint32_t gen;               // segment generation it was written in
+    uint32_t crc;               // CRC32C of the header (crc = 0) and payload
+};
+
+static_assert(sizeof(EntryHeader) == 24, "EntryHeader must stay 24 bytes");
+
+static inline size_t entry_size(uint32_t len)
+{
+    return sizeof(EntryHeader) + ((len + 7) & ~7u);
+}
+
+struct PmLog {
+    char *base = nullptr;
+    uint64_t nseg = 0;
+    uint64_t seg_size = 0;
+    std::atomic<uint64_t> next_lsn{1};
+
+    /*
+     * Lay out `nseg` empty segments over [pm, pm + size).
+     */
+    void format(char *pm, size_t size, int n)
+    {
+        base = pm;
+        nseg = n;
+        seg_size = (size - NVM_BLOCK_SIZE) / n / NVM_BLOCK_SIZE * NVM_BLOCK_SIZE;
+        SegmentHeader sh;
+        memset(&sh, 0, sizeof(sh));
+        sh.gen = 1;
+        for (uint64_t s = 0; s < nseg; ++s)
+            memmove_movnt_avx512f_clwb(segment(s), (char *)&sh, sizeof(sh));
+        LogHeader h = {LogMagic, nseg, seg_size};
+        memmove_movnt_avx512f_clwb(base, (char *)&h, sizeof(h));
+    }
+
+    bool open(char *pm)
+    {
+        LogHeader h;
+        memcpy(&h, pm, sizeof(h));
+        if (h.magic != LogMagic)
+            return false;
+        base = pm;
+        nseg = h.nseg;
+        seg_size = h.seg_size;
+        return true;
+    }
+
+    char *segment(uint64_t s) const { return base + NVM_BLOCK_SIZE + s * seg_size; }
+};
+
+/*
+ * Per-producer handle on one segment. Not thread-safe.
+ */
+struct LogWriter {
+    PmLog *log = nullptr;
+    SegmentHeader *sh = nullptr;
+    char *data = nullptr;
+    uint64_t cap = 0;
+    uint64_t tail = 0;          // appended bytes, committed or not
+    uint64_t gen = 0;
+    uint32_t pending = 0;       // entries appended since the last commit
+
+    void init(PmLog *l, uint64_t seg)
+    {
+        log = l;
+        sh = (SegmentHeader *)l->segment(seg);
+        data = (char *)sh + sizeof(SegmentHeader);
+        cap = l->seg_size - sizeof(SegmentHeader);
+        tail = sh->tail;
+        gen = sh->gen;
+        pending = 0;
+    }
+
+    /*
+     * Write an entry after the tail, not yet durable. Returns its lsn.
+     */
+    uint64_t append(const void *payload, uint32_t len)
+    {
+        const size_t sz = entry_size(len);
+        if (tail + sz > cap)
+            wrap();
+
+        EntryHeader h = {EntryMagic, len, log->next_lsn.fetch_add(1, std::memory_order_relaxed),
+                         (uint32_t)gen, 0};
+        char *dst = data + tail;
+        uint32_t crc = crc32c(0, &h, sizeof(h));
+        h.crc = memmove_movnt_crc_avx512f(dst + sizeof(h), (const char *)payload, len, crc,
+                                          flush_clwb_nolog, no_barrier_after_ntstores);
+        memmove_movnt_avx512f(dst, (char *)&h, sizeof(h), flush_clwb_nolog, no_barrier_after_ntstores);
+
+        tail += sz;
+        pending++;
+        return h.lsn;
+    }
+
+    /*
+     * Group commit: make every entry appended so far durable.
+     */
+    void commit()
+    {
+        if (pending == 0)
+            return;
+        _mm_sfence();
+        persist_tail(tail);
+        pending = 0;
+    }
+
+private:
+    void persist_tail(uint64_t t)
+    {
+        sh->tail = t;
+        pmem_clwb(&sh->tail);
+        _mm_sfence();
+    }
+
+    /*
+     * Start the segment over: commit what is pending, reset the tail, then a
+     * new generation invalidates the old entries. A crash in between leaves
+     * the old entries past an empty tail, i.e. uncommitted, never corrupt.
+     */
+    void wrap()
+    {
+        commit();
+        persist_tail(0);
+        tail = 0;
+        gen++;
+        sh->gen = gen;
+        pmem_clwb(&sh->gen);
+        _mm_sfence();
+    }
+};
+
+struct SegmentRecovery {
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t max_lsn = 0;
+    uint64_t corrupt = 0;       // bad entries below the committed tail
+    uint64_t uncommitted = 0;   // intact entries past the tail, to be discarded
+};
+
+/*
+ * Scan one segment: every entry below the persisted tail must be intact;
+ * intact entries past it were appended but never committed.
+ */
+static inline SegmentRecovery log_recover_segment(const PmLog &log, uint64_t seg)
+{
+    SegmentRecovery res;
+    const SegmentHeader *sh = (const SegmentHeader *)log.segment(seg);
+    const char *data = (const char *)sh + sizeof(SegmentHeader);
+    const uint64_t cap = log.seg_size - sizeof(SegmentHeader);
+
+    auto check = [&](uint64_t off, EntryHeader &h) {
+        if (off + sizeof(h) > cap)
+            return false;
+        memcpy(&h, data + off, sizeof(h));
+        if (h.magic != EntryMagic || h.gen != sh->gen || off + entry_size(h.len) > cap)
+            return false;
+        uint32_t crc = h.crc;
+        h.crc = 0;
+        uint32_t c = crc32c(crc32c(0, &h, sizeof(h)), data + off + sizeof(h), h.len);
+        h.crc = crc;
+        return c == crc;
+    };
+
+    EntryHeader h;
+    uint64_t off = 0;
+    while (off < sh->tail) {
+        if (!check(off, h)) {
+            res.corrupt++;
+            return res;
+        }
+        res.entries++;
+        res.bytes += h.len;
+        res.max_lsn = std::max(res.max_lsn, h.lsn);
+        off += entry_size(h.len);
+    }
+    while (check(off, h)) {
+        res.uncommitted++;
+        off += entry_size(h.len);
+    }
+    return res;
+}
+
+#endif // PMLOG_H
@@ -0,0 +1,116 @@
+#if !defined(RECORD_H)
+#define RECORD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <x86intrin.h>
+
+/*
+ * Self-describing records for crash-consistency checks.
+ *
+ * Every record fills one Granularity-sized slot: a header followed by a
+ * payload derived from (run, writer, seq). The CRC32C covers the whole
+ * record with the crc field zeroed, so a partially persisted (torn) record
+ * is detected no matter which part of it made it to PM.
+ *
+ * Writer w owns slots [w * Units, (w + 1) * Units) of the region and writes
+ * seq s (starting at 1) into its slot (s - 1) % Units.
+ *
+ * A run id is the start time in seconds over TSC bits, so that runs started
+ * within the same second still differ and order by start.
+ */
+
+static const uint32_t RecordMagic = 0x4d505243;     // "CRPM"
+
+struct __attribute__((packed)) RecordHeader {
+    uint32_t magic;
+    uint32_t len;       // record length, header included
+    uint32_t run;       // run id, high half: to tell this run from earlier ones
+    uint16_t writer;
+    uint16_t inflight;  // records the writer may have in flight at a crash
+    uint64_t seq;
+    uint64_t offset;    // offset of the record in the region
+    uint32_t crc;
+    uint32_t run_lo;    // run id, low half
+};
+
+static_assert(sizeof(RecordHeader) == 40, "RecordHeader must stay 40 bytes");
+
+static inline uint64_t record_run_id()
+{
+    return (uint64_t)time(nullptr) << 32 | (uint32_t)(__rdtsc() >> 16);
+}
+
+static inline uint64_t record_run(const RecordHeader &h) { return (uint64_t)h.run << 32 | h.run_lo; }
+
+static inline uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    uint64_t c = ~crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; len > 0; --len, ++p)
+        c = _mm_crc32_u8((uint32_t)c, *(const uint8_t *)p);
+    return ~(uint32_t)c;
+}
+
+static inline uint32_t record_crc(const char *rec, uint32_t len)
+{
+    RecordHeader h;
+    memcpy(&h, rec, sizeof(h));
+    h.crc = 0;
+    uint32_t crc = crc32c(0, &h, sizeof(h));
+    return crc32c(crc, rec + sizeof(h), len - sizeof(h));
+}
+
+/*
+ * Build a record of `len` bytes (a multiple of 8) into `buf`.
+ */
+static inline void record_fill(char *buf, uint32_t len, uint64_t run, uint16_t writer, uint16_t inflight,
+                               uint64_t seq, uint64_t offset)
+{
+    RecordHeader *h = (RecordHeader *)buf;
+    h->magic = RecordMagic;
+    h->len = len;
+    h->run = (uint32_t)(run >> 32);
+    h->writer = writer;
+    h->inflight = inflight;
+    h->seq = seq;
+    h->offset = offset;
+    h->crc = 0;
+    h->run_lo = (uint32_t)run;
+
+    uint64_t pattern = seq * 0x9e3779b97f4a7c15ull ^ (run << 16 | writer);
+    uint64_t *p = (uint64_t *)(buf + sizeof(RecordHeader));
+    for (uint32_t i = 0; i < (len - sizeof(RecordHeader)) / 8; ++i)
+        p[i] = pattern + i;
+
+    h->crc = record_crc(buf, len);
+}
+
+enum RecordState {
+    RecEmpty = 0,       // no record header in the slot
+    RecValid,
+    RecTorn,            // header present but checksum mismatch
+    RecMisplaced,       // valid record whose offset/len does not match the slot
+};
+
+static inline RecordState record_check(const char *rec, uint32_t len, uint64_t offset, RecordHeader &h)
+{
+    memcpy(&h, rec, sizeof(h));
+    if (h.magic != RecordMagic)
+        return RecEmpty;
+    if (h.len != len)
+        return RecMisplaced;
+    if (record_crc(rec, len) != h.crc)
+        return RecTorn;
+    if (h.offset != offset)
+        return RecMisplaced;
+    return RecValid;
+}
+
+#endif // RECORD_H
@@ -325,6 +325,35 @@ public:
   Result<std::string> reply_cur(const ByteBuffer &buf) {
     return raw_send(buf, cur_msg_client.value());
   };
+
+  /*!
+    The socket, so that callers can wait for msgs on it (e.g. with epoll).
+   */
+  int fd() const { return sock_fd; }
+
+  /*!
+    Recv one msg into buf without waiting, if there is one. Unlike
+    start()/cur(), the buffer is the caller's, so several threads can serve
+    the channel at once.
+    \ret:
+    - Ok: the sender, for reply_to()
+    - NotReady: no msg pending
+   */
+  Result<sockaddr> recv_nonblock(ByteBuffer &buf) {
+    struct sockaddr addr;
+    socklen_t len = sizeof(addr);
+    auto n = recvfrom(sock_fd, (char *)(buf.data()), buf.size(), MSG_DONTWAIT,
+                      &addr, &len);
+    if (n >= 0)
+      return Ok(addr);
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return NotReady(addr);
+    return Err(addr);
+  }
+
+  Result<std::string> reply_to(const ByteBuffer &buf, const sockaddr &addr) {
+    return raw_send(buf, addr);
+  }
 }; // namespace bootstrap
 
 } // namespace bootstrap
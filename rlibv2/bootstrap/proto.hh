@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../rmem/handler.hh"
+#include "../rmem/chunked.hh"
 #include "../qps/mod.hh"
 
 namespace rdmaio {
@@ -20,6 +21,7 @@ enum RCtrlBinderIdType : rpc_id_t {
   DeleteRC,
   FetchQPAttr,  // fetch a created QP's attr. useful for UD QP
   FetchDCAttr,  // fetch a DC attr. used for DCT
+  CreateRCBatch, // create and connect several RCs (for one-sided) at once
   Reserved,
 };
 
@@ -43,6 +45,8 @@ struct __attribute__((packed)) MRReq {
 struct __attribute__((packed)) MRReply {
   CallbackStatus status;
   ::rdmaio::rmem::RegAttr attr;
+  // the chunk table; a single chunk for an MR registered as a whole
+  ::rdmaio::rmem::MRChunks chunks;
 };
 
 /*******************************************/
@@ -80,6 +84,31 @@ struct __attribute__((packed)) RCReply {
   u64 key;
 };
 
+/*!
+  Req/Reply for creating a batch of RC QPs in one exchange.
+  QP i of the batch is named prefix + std::to_string(first + i).
+  kMaxBatchRC keeps both the request and the reply within one bootstrap
+  message (kMaxMsgSz).
+ */
+const usize kMaxBatchRC = 48;
+
+struct __attribute__((packed)) RCBatchReq {
+  char prefix[::rdmaio::qp::kMaxQPNameLen + 1];
+  u32 first = 0;
+  u32 num = 0;
+
+  ::rdmaio::nic_id_t nic_id;
+  ::rdmaio::qp::QPConfig config;
+  ::rdmaio::qp::QPAttr attrs[kMaxBatchRC]; // the attrs used for connect
+};
+
+struct __attribute__((packed)) RCBatchReply {
+  CallbackStatus status;
+  u32 num = 0;
+  ::rdmaio::qp::QPAttr attrs[kMaxBatchRC];
+  u64 keys[kMaxBatchRC];
+};
+
 // struct __attribute__((packed)) DCReply {
 //   CallbackStatus status;
 //   ::rdmaio::qp::DCAttr attr;
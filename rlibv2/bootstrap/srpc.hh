@@ -3,6 +3,8 @@
 #include <mutex>   // lock
 #include <utility> // std::pair
 
+#include <sys/epoll.h>
+
 #include "./channel.hh"
 #include "./multi_msg.hh"
 #include "./proto.hh"
@@ -176,75 +178,118 @@ public:
    */
   usize run_one_event_loop() {
     usize count = 0;
-    for (channel->start(1000000); channel->has_msg(); channel->next(), count += 1) {
-
-      auto &msg = channel->cur();
-
-      u64 checksum = SRpc::invalid_checksum;
-      try {
-        MultiMsg<kMaxMsgSz> segmeneted_msg;
-        SRpcHeader header;
-        try {
-          // create from move the cur_msg to a MuiltiMsg
-          segmeneted_msg = MultiMsg<kMaxMsgSz>::create_from(msg).value();
-
-          // query the RPC call id
-          header = ::rdmaio::Marshal::dedump<SRpcHeader>(
-                       segmeneted_msg.query_one(0).value())
-                       .value();
-
-          checksum = header.checksum;
-        } catch (std::exception &e) {
-          // some error happens, which is fatal because we cannot decode the
-          // checksum
-
-          MultiMsg<kMaxMsgSz> coded_reply =
-            MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader)).value();
-
-          coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
-              {.callstatus = CallStatus::FatalErr,
-               .checksum = checksum,
-               .dummy = 0}));
-          channel->reply_cur(*coded_reply.buf);
+    for (channel->start(1000000); channel->has_msg(); channel->next(), count += 1)
+      channel->reply_cur(handle(channel->cur()));
+    return count;
+  }
 
+  /*!
+    Serve RPC calls as they arrive, until stop_fd (e.g. an eventfd) becomes
+    readable. Any number of threads may run this at once: each waits in its
+    own epoll set, and EPOLLEXCLUSIVE wakes only one of them per arrival, so
+    idle threads sleep instead of spinning.
+    \ret: number of PRCs served by this thread
+   */
+  usize run_event_loop(int stop_fd) {
+    int ep = epoll_create1(0);
+    if (ep < 0)
+      return 0;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = channel->fd();
+    epoll_ctl(ep, EPOLL_CTL_ADD, channel->fd(), &ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = stop_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, stop_fd, &ev);
+
+    ByteBuffer msg(kMaxMsgSz, '\0');
+    usize count = 0;
+    for (bool running = true; running;) {
+      struct epoll_event evs[2];
+      int n = epoll_wait(ep, evs, 2, -1);
+      for (int i = 0; i < n; ++i) {
+        if (evs[i].data.fd == stop_fd) {
+          running = false;
           continue;
         }
+        // one msg per wake-up, so that a burst spreads over the threads;
+        // another thread may have taken it already
+        auto from = channel->recv_nonblock(msg);
+        if (from != IOCode::Ok)
+          continue;
+        channel->reply_to(handle(msg), from.desc);
+        count += 1;
+      }
+    }
+    close(ep);
+    return count;
+  }
 
-        // really handles the request
-        rpc_id_t id = header.id;
-
-        ByteBuffer parameter = segmeneted_msg.query_one(1).value();
-
-        // call the RPC
-        ByteBuffer reply = factory.call_one(id, parameter);
-
-        MultiMsg<kMaxMsgSz> coded_reply =
-            MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader) +
-                                              reply.size())
-                .value();
-        coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
-            {.callstatus = CallStatus::Ok,
-             .checksum = checksum,
-             .dummy = (id == RCtrlBinderIdType::HeartBeat)
-                          ? static_cast<u8>(1)
-                          : static_cast<u8>(0)}));
-        coded_reply.append(reply);
+private:
+  /*!
+    Decode one RPC call, run its handler and encode the reply.
+   */
+  ByteBuffer handle(ByteBuffer &msg) {
+    u64 checksum = SRpc::invalid_checksum;
+    try {
+      MultiMsg<kMaxMsgSz> segmeneted_msg;
+      SRpcHeader header;
+      try {
+        // create from move the cur_msg to a MuiltiMsg
+        segmeneted_msg = MultiMsg<kMaxMsgSz>::create_from(msg).value();
 
-        // send the reply to the client
-        channel->reply_cur(*coded_reply.buf);
+        // query the RPC call id
+        header = ::rdmaio::Marshal::dedump<SRpcHeader>(
+                     segmeneted_msg.query_one(0).value())
+                     .value();
 
+        checksum = header.checksum;
       } catch (std::exception &e) {
+        // some error happens, which is fatal because we cannot decode the
+        // checksum
+
         MultiMsg<kMaxMsgSz> coded_reply =
           MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader)).value();
 
-        // some error happens
         coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
-            {.callstatus = CallStatus::Nop, .checksum = checksum}));
-        channel->reply_cur(*coded_reply.buf);
+            {.callstatus = CallStatus::FatalErr,
+             .checksum = checksum,
+             .dummy = 0}));
+        return *coded_reply.buf;
       }
-    }
 
-    return count;
+      // really handles the request
+      rpc_id_t id = header.id;
+
+      ByteBuffer parameter = segmeneted_msg.query_one(1).value();
+
+      // call the RPC
+      ByteBuffer reply = factory.call_one(id, parameter);
+
+      MultiMsg<kMaxMsgSz> coded_reply =
+          MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader) +
+                                            reply.size())
+              .value();
+      coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
+          {.callstatus = CallStatus::Ok,
+           .checksum = checksum,
+           .dummy = (id == RCtrlBinderIdType::HeartBeat)
+                        ? static_cast<u8>(1)
+                        : static_cast<u8>(0)}));
+      coded_reply.append(reply);
+
+      // the reply to the client
+      return *coded_reply.buf;
+
+    } catch (std::exception &e) {
+      MultiMsg<kMaxMsgSz> coded_reply =
+        MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader)).value();
+
+      // some error happens
+      coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
+          {.callstatus = CallStatus::Nop, .checksum = checksum}));
+      return *coded_reply.buf;
+    }
   }
 };
 
@@ -199,6 +199,92 @@ public:
     return ::rdmaio::Err(std::make_pair(err_str, temp_key));
   }
 
+  /*!
+    Like cc_rc(), for all of rcs at once: remote QP i is named
+    prefix + std::to_string(first + i). The QPs go in batches of
+    proto::kMaxBatchRC, one round trip per batch instead of one per QP.
+
+    \ret the keys of the remote QPs; on error, those of the batches that
+    succeeded
+   */
+  using cc_rc_batch_ret_t = std::pair<std::string, std::vector<u64>>;
+  Result<cc_rc_batch_ret_t>
+  cc_rc_batch(const std::string &prefix,
+              const std::vector<Arc<::rdmaio::qp::RC>> &rcs,
+              const ::rdmaio::nic_id_t &nic_id,
+              const ::rdmaio::qp::QPConfig &config, const u32 &first = 0,
+              const double &timeout_usec = 1000000) {
+    auto err_str = std::string("unknown error");
+    std::vector<u64> keys;
+
+    if (unlikely(prefix.size() > ::rdmaio::qp::kMaxQPNameLen)) {
+      err_str = err_name_to_long;
+      goto ErrCase;
+    }
+
+    while (keys.size() < rcs.size()) {
+      const usize base = keys.size();
+      const usize num = std::min<usize>(rcs.size() - base, proto::kMaxBatchRC);
+
+      proto::RCBatchReq req = {};
+      memcpy(req.prefix, prefix.data(), prefix.size());
+      req.first = static_cast<u32>(first + base);
+      req.num = static_cast<u32>(num);
+      req.nic_id = nic_id;
+      req.config = config;
+      for (usize i = 0; i < num; ++i)
+        req.attrs[i] = rcs[base + i]->my_attr();
+
+      auto res = rpc.call(proto::CreateRCBatch,
+                          ::rdmaio::Marshal::dump<proto::RCBatchReq>(req));
+      if (unlikely(res != IOCode::Ok)) {
+        err_str = res.desc;
+        goto ErrCase;
+      }
+
+      auto res_reply = rpc.receive_reply(timeout_usec);
+      if (res_reply != IOCode::Ok) {
+        err_str = res_reply.desc;
+        goto ErrCase;
+      }
+      try {
+        auto reply =
+            ::rdmaio::Marshal::dedump<proto::RCBatchReply>(res_reply.desc)
+                .value();
+        switch (reply.status) {
+        case proto::CallbackStatus::Ok:
+          break;
+        case proto::CallbackStatus::ConnectErr:
+          err_str = "Remote connect error";
+          goto ErrCase;
+        case proto::CallbackStatus::WrongArg:
+          err_str = "Wrong arguments, possible a QP of the batch exists";
+          goto ErrCase;
+        default:
+          err_str = err_unknown_status;
+          goto ErrCase;
+        }
+        for (usize i = 0; i < num; ++i) {
+          const ::rdmaio::qp::QPAttr attr = reply.attrs[i];
+          auto ret = rcs[base + i]->connect(attr);
+          if (ret != IOCode::Ok) {
+            err_str = ret.desc;
+            goto ErrCase;
+          }
+        }
+        for (usize i = 0; i < num; ++i)
+          keys.push_back(reply.keys[i]);
+      } catch (std::exception &e) {
+        err_str = err_decode_reply;
+        goto ErrCase;
+      }
+    }
+    return ::rdmaio::Ok(std::make_pair(std::string(""), keys));
+
+  ErrCase:
+    return ::rdmaio::Err(std::make_pair(err_str, keys));
+  }
+
   Result<cc_rc_ret_t> cc_rc_msg(const std::string &qp_name,
                                 const std::string &channel_name,
                                 const usize &msg_sz,
@@ -280,6 +366,20 @@ public:
   using mr_res_t = std::pair<std::string, rmem::RegAttr>;
   Result<mr_res_t> fetch_remote_mr(const rmem::register_id_t &id,
                                    const double &timeout_usec = 1000000) {
+    auto res = fetch_remote_mr_chunks(id, timeout_usec);
+    return ::rdmaio::transfer(
+        res, std::make_pair(std::get<0>(res.desc), std::get<1>(res.desc).attr));
+  }
+
+  /*!
+    Fetch the chunk table of remote MR "id", which may have been registered
+    in chunks (rmem::ChunkedRegHandler); an MR registered as a whole is a
+    single chunk.
+   */
+  using mr_chunks_res_t = std::pair<std::string, rmem::MRChunks>;
+  Result<mr_chunks_res_t>
+  fetch_remote_mr_chunks(const rmem::register_id_t &id,
+                         const double &timeout_usec = 1000000) {
     auto res = rpc.call(proto::FetchMr,
                         ::rdmaio::Marshal::dump<proto::MRReq>({.id = id}));
     auto res_reply = rpc.receive_reply(timeout_usec);
@@ -290,20 +390,20 @@ public:
             ::rdmaio::Marshal::dedump<proto::MRReply>(res_reply.desc).value();
         switch (mr_reply.status) {
         case proto::CallbackStatus::Ok:
-          return ::rdmaio::Ok(std::make_pair(std::string(""), mr_reply.attr));
+          return ::rdmaio::Ok(std::make_pair(std::string(""), mr_reply.chunks));
         case proto::CallbackStatus::NotFound:
-          return NotReady(std::make_pair(std::string(""), rmem::RegAttr()));
+          return NotReady(std::make_pair(std::string(""), rmem::MRChunks()));
         default:
           return ::rdmaio::Err(
-              std::make_pair(err_unknown_status, rmem::RegAttr()));
+              std::make_pair(err_unknown_status, rmem::MRChunks()));
         }
 
       } catch (std::exception &e) {
-        return ::rdmaio::Err(std::make_pair(err_decode_reply, rmem::RegAttr()));
+        return ::rdmaio::Err(std::make_pair(err_decode_reply, rmem::MRChunks()));
       }
     }
     return ::rdmaio::transfer(res_reply,
-                              std::make_pair(res_reply.desc, rmem::RegAttr()));
+                              std::make_pair(res_reply.desc, rmem::MRChunks()));
   }
 
   /*!
@@ -10,7 +10,8 @@ class AbsRecvAllocator {
 public:
   /*!
     allocate an RDMA recv buffer,
-    which has (ptr, key)
+    which has (ptr, key);
+    may be called from several RCtrl handler threads at once
    */
   virtual Option<std::pair<rmem::RMem::raw_ptr_t, rmem::mr_key_t>>
   alloc_one(const usize &sz) = 0;
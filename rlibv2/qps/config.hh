@@ -64,6 +64,23 @@ public:
     return max_recv_size;
   }
 
+  /*!
+    SGEs per send/recv request, e.g. for Op<NSGE> with NSGE > 1
+   */
+  QPConfig &set_max_send_sge(int num) {
+    max_send_sge = num;
+    return *this;
+  }
+
+  int max_send_sge_num() const { return max_send_sge; }
+
+  QPConfig &set_max_recv_sge(int num) {
+    max_recv_sge = num;
+    return *this;
+  }
+
+  int max_recv_sge_num() const { return max_recv_sge; }
+
   QPConfig &add_access_write() {
     access_flags |= IBV_ACCESS_REMOTE_WRITE;
     return *this;
@@ -116,6 +133,8 @@ private:
   int timeout = 20;
   int max_send_size = kRcMaxSendSz;
   int max_recv_size = kRcMaxRecvSz;
+  int max_send_sge = 1;
+  int max_recv_sge = 1;
 
   int qkey = kDefaultQKey;
 
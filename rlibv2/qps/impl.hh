@@ -116,7 +116,8 @@ public:
   static CreateQPRes_t create_qp(Arc<RNic> nic, ibv_qp_type type,
                                  const QPConfig &config,
                                  ibv_cq *cq, // send cq
-                                 ibv_cq *recv_cq = nullptr) {
+                                 ibv_cq *recv_cq = nullptr,
+                                 ibv_srq *srq = nullptr) {
 
     if (cq == nullptr) {
       return Err(std::make_pair<ibv_qp *, std::string>(nullptr,
@@ -131,13 +132,14 @@ public:
 
     qp_init_attr.send_cq = cq;
     qp_init_attr.recv_cq = recv_cq;
+    qp_init_attr.srq = srq; // if set, recvs are taken from it, max_recv_wr is ignored
     qp_init_attr.qp_type = type;
     qp_init_attr.sq_sig_all = 0;
 
     qp_init_attr.cap.max_send_wr = config.max_send_sz();
     qp_init_attr.cap.max_recv_wr = config.max_recv_sz();
-    qp_init_attr.cap.max_send_sge = 1;
-    qp_init_attr.cap.max_recv_sge = 1;
+    qp_init_attr.cap.max_send_sge = config.max_send_sge_num();
+    qp_init_attr.cap.max_recv_sge = config.max_recv_sge_num();
     qp_init_attr.cap.max_inline_data = kMaxInlinSz;
 
     auto qp = ibv_create_qp(nic->get_pd(), &qp_init_attr);
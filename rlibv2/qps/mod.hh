@@ -1,5 +1,7 @@
 #pragma once
 
+#include <utility>
+
 #include "../common.hh"
 #include "../naming.hh"
 #include "../nic.hh"
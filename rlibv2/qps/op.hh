@@ -133,7 +133,7 @@ public:
 
   template <typename T>
   inline bool set_payload(const T *addr, const u32 &length, const u32 &lkey, const u32 index = 0) {
-    if (this->wr.num_sge <= index) {
+    if (static_cast<u32>(this->wr.num_sge) <= index) {
       return false;
     }
 
@@ -65,7 +65,9 @@ public:
      }
   */
 private:
-  RC(Arc<RNic> nic, const QPConfig &config,ibv_cq *recv_cq = nullptr) : Dummy(nic), my_config(config) {
+  RC(Arc<RNic> nic, const QPConfig &config, ibv_cq *recv_cq = nullptr,
+     ibv_srq *srq = nullptr)
+      : Dummy(nic), my_config(config) {
     /*
       It takes 3 steps to create an RC QP during the initialization
       according to the RDMA programming mannal.
@@ -88,7 +90,7 @@ private:
 
     // 2 qp
     auto res_qp =
-        Impl::create_qp(nic, IBV_QPT_RC, my_config, this->cq, this->recv_cq);
+        Impl::create_qp(nic, IBV_QPT_RC, my_config, this->cq, this->recv_cq, srq);
     if (res_qp != IOCode::Ok) {
       RDMA_LOG(4) << "Error on creating QP: " << std::get<1>(res.desc);
       return;
@@ -104,10 +106,15 @@ private:
   }
 
 public:
+  /*!
+    \param srq: if not null, the QP takes its recv entries from this shared
+    receive queue (see ./srq.hh) instead of posting its own.
+   */
   static Option<Arc<RC>> create(Arc<RNic> nic,
                                 const QPConfig &config = QPConfig(),
-                                ibv_cq *recv_cq = nullptr) {
-    auto res = Arc<RC>(new RC(nic, config,recv_cq));
+                                ibv_cq *recv_cq = nullptr,
+                                ibv_srq *srq = nullptr) {
+    auto res = Arc<RC>(new RC(nic, config, recv_cq, srq));
     if (res->valid()) {
       return Option<Arc<RC>>(std::move(res));
     }
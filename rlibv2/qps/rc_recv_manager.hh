@@ -3,22 +3,28 @@
 #include "../rctrl.hh"
 
 #include "./recv_helper.hh"
+#include "./srq.hh"
 
 namespace rdmaio {
 
 namespace qp {
 /*!
-  Common structure shared by a recv endpoint
+  Common structure shared by a recv endpoint.
+  If srq is set, QPs created on this endpoint attach to the shared receive
+  queue, and no per-QP RecvEntries are allocated; the owner of the srq
+  keeps it filled (see ./srq.hh).
  */
 struct RecvCommon {
   ibv_cq *cq;
   Arc<AbsRecvAllocator> allocator;
+  ibv_srq *srq = nullptr;
 
-  RecvCommon(ibv_cq *cq, Arc<AbsRecvAllocator> alloc)
-      : cq(cq), allocator(alloc) {}
+  RecvCommon(ibv_cq *cq, Arc<AbsRecvAllocator> alloc, ibv_srq *srq = nullptr)
+      : cq(cq), allocator(alloc), srq(srq) {}
 
-  static Option<Arc<RecvCommon>> create(ibv_cq *cq, Arc<AbsRecvAllocator> alloc) {
-    return std::make_shared<RecvCommon>(cq,alloc);
+  static Option<Arc<RecvCommon>> create(ibv_cq *cq, Arc<AbsRecvAllocator> alloc,
+                                        ibv_srq *srq = nullptr) {
+    return std::make_shared<RecvCommon>(cq, alloc, srq);
   }
 };
 
@@ -72,16 +78,17 @@ public:
 
         // 1.0 check whether we are able to use the registered recv_cq
         ibv_cq *recv_cq = nullptr;
+        ibv_srq *srq = nullptr;
         if (rc_req.whether_recv == 1) {
           auto recv_c_res = reg_recv_cqs.query(rc_req.name_recv);
           if (!recv_c_res)
-            recv_cq = nullptr;
-          else
-            recv_cq = recv_c_res.value()->cq;
+            goto WA; // no such channel
+          recv_cq = recv_c_res.value()->cq;
+          srq = recv_c_res.value()->srq;
         }
 
         // 1.1 try to create and register this QP
-        auto rc = qp::RC::create(nic.value(), rc_req.config, recv_cq).value();
+        auto rc = qp::RC::create(nic.value(), rc_req.config, recv_cq, srq).value();
         auto rc_status = rctrl_p->registered_qps.reg(rc_req.name, rc);
 
         if (!rc_status) {
@@ -98,13 +105,16 @@ public:
         key = rc_status.value();
 
         // 1.3 this QP is done, alloc the recv; entries
-        auto recv_c_res = reg_recv_cqs.query(rc_req.name_recv); // must exsist, because we have checked in step 1.0
-        auto recv_entries = RecvEntriesFactoryv2<R>::create(recv_c_res.value()->allocator, rc_req.max_recv_sz);
-        RDMA_ASSERT(reg_recv_entries.reg(rc_req.name, recv_entries));
-
-        // 1.4 we post_recvs
-        auto res = rc->post_recvs(*recv_entries, R);
-        RDMA_ASSERT(res == IOCode::Ok); // FIXME: now assert false if failed
+        // (not with an srq: the QP shares the srq's buffers)
+        if (srq == nullptr) {
+          auto recv_c_res = reg_recv_cqs.query(rc_req.name_recv); // must exsist, because we have checked in step 1.0
+          auto recv_entries = RecvEntriesFactoryv2<R>::create(recv_c_res.value()->allocator, rc_req.max_recv_sz);
+          RDMA_ASSERT(reg_recv_entries.reg(rc_req.name, recv_entries));
+
+          // 1.4 we post_recvs
+          auto res = rc->post_recvs(*recv_entries, R);
+          RDMA_ASSERT(res == IOCode::Ok); // FIXME: now assert false if failed
+        }
       }
 
       // 2. fetch the QP result
@@ -65,6 +65,12 @@ public:
     return {};
   }
 
+  /*!
+    the completion of the current message, e.g., to tell a SEND from a
+    write with immediate by its opcode
+   */
+  const ibv_wc &cur_wc() const { return wcs[idx]; }
+
   inline void next() { idx += 1; }
 
   inline bool has_msgs() const { return idx < total_msgs; }
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "./impl.hh"
+#include "./recv_helper.hh"
+
+namespace rdmaio {
+
+namespace qp {
+
+/*!
+  A shared receive queue together with the pool of N recv buffers posted to
+  it. Any number of QPs (created with RC::create(..., srq.srq)) consume from
+  the same buffers, so the memory no longer grows with the number of QPs.
+
+  Buffers are identified by their address (the wr_id of the completion).
+  Consumed buffers are handed back with release() and reposted in bulk, with
+  a single ibv_post_srq_recv, by refill().
+
+  Example:
+  `
+  auto srq = SRQ<1024>::create(nic, alloc, msg_sz).value();
+  // ... poll the recv cq shared by the QPs, for each wc:
+  //       process((char *)wc.wr_id); srq->release(wc.wr_id);
+  srq->refill();
+  `
+ */
+template <usize N> class SRQ {
+  struct ibv_recv_wr rs[N];
+  struct ibv_sge sges[N];
+
+  // buffers released but not yet reposted
+  usize pending = 0;
+
+  rmem::mr_key_t lkey = 0;
+  usize msg_sz = 0;
+
+  SRQ(ibv_srq *srq, rmem::mr_key_t lkey, const usize &msg_sz)
+      : srq(srq), lkey(lkey), msg_sz(msg_sz) {}
+
+public:
+  ibv_srq *srq = nullptr;
+
+  static Option<Arc<SRQ>> create(Arc<RNic> nic, Arc<AbsRecvAllocator> &alloc,
+                                 const usize &msg_sz) {
+    auto res = Impl::create_srq(nic, N, 1);
+    if (res != IOCode::Ok) {
+      RDMA_LOG(4) << "Error on creating SRQ: " << std::get<1>(res.desc);
+      return {};
+    }
+
+    Arc<SRQ> ret(new SRQ(std::get<0>(res.desc), 0, msg_sz));
+    for (uint i = 0; i < N; ++i) {
+      auto buf = alloc->alloc_one(msg_sz);
+      if (!buf)
+        return {};
+      ret->lkey = std::get<1>(buf.value());
+      ret->release(reinterpret_cast<u64>(std::get<0>(buf.value())));
+    }
+    if (ret->refill() != IOCode::Ok)
+      return {};
+    return ret;
+  }
+
+  /*!
+    Hand back a consumed buffer; it is reposted by the next refill().
+    \note all buffers must come from one MR (share the lkey).
+   */
+  void release(const u64 &wr_id) {
+    sges[pending] = {.addr = wr_id, .length = static_cast<u32>(msg_sz),
+                     .lkey = lkey};
+    rs[pending].wr_id = wr_id;
+    rs[pending].sg_list = &sges[pending];
+    rs[pending].num_sge = 1;
+    rs[pending].next = nullptr;
+    if (pending > 0)
+      rs[pending - 1].next = &rs[pending];
+    pending += 1;
+  }
+
+  /*!
+    Repost all released buffers at once.
+    \ret
+    - Err: errno
+    - Ok: number of buffers reposted
+   */
+  Result<int> refill() {
+    if (pending == 0)
+      return ::rdmaio::Ok(0);
+    struct ibv_recv_wr *bad_rr;
+    auto rc = ibv_post_srq_recv(srq, rs, &bad_rr);
+    if (rc != 0)
+      return ::rdmaio::Err(rc);
+    int num = static_cast<int>(pending);
+    pending = 0;
+    return ::rdmaio::Ok(num);
+  }
+
+  usize capacity() const { return N; }
+
+  ~SRQ() {
+    if (srq)
+      ibv_destroy_srq(srq);
+  }
+};
+
+} // namespace qp
+
+} // namespace rdmaio
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <map>
+
+#include "./ud.hh"
+
+namespace rdmaio {
+
+namespace qp {
+
+/*!
+  Address handles of the peers of a UD QP, created on first use and kept
+  until the cache is destroyed. A peer is found either by its QPAttr (e.g.
+  fetched with ConnectManager::fetch_qp_attr), or by a received message,
+  so that a server can reply to any client without per-client setup.
+
+  Example:
+  `
+  AHCache ahs(ud);
+  ibv_ah *ah = ahs.query(server_attr);
+  // at the server, for a recv completion wc whose buffer is buf:
+  ibv_ah *reply_ah = ahs.query(wc, (ibv_grh *)buf);
+  `
+ */
+class AHCache {
+  Arc<UD> ud;
+  // (gid interface id, lid) -> ah
+  std::map<std::pair<u64, u64>, ibv_ah *> ahs;
+
+public:
+  explicit AHCache(Arc<UD> ud) : ud(std::move(ud)) {}
+
+  ibv_ah *query(const QPAttr &attr) {
+    auto key = std::make_pair(attr.addr.interface_id, attr.lid);
+    auto it = ahs.find(key);
+    if (it != ahs.end())
+      return it->second;
+    auto ah = ud->create_ah(attr);
+    if (ah != nullptr)
+      ahs.insert(std::make_pair(key, ah));
+    return ah;
+  }
+
+  /*!
+    \param grh: the first kGRHSz bytes of the recv buffer of wc
+   */
+  ibv_ah *query(const ibv_wc &wc, ibv_grh *grh) {
+    u64 gid = (wc.wc_flags & IBV_WC_GRH) ? grh->sgid.global.interface_id : 0;
+    auto key = std::make_pair(gid, static_cast<u64>(wc.slid));
+    auto it = ahs.find(key);
+    if (it != ahs.end())
+      return it->second;
+    auto ah = ibv_create_ah_from_wc(ud->nic->get_pd(), const_cast<ibv_wc *>(&wc),
+                                    grh, ud->nic->id.port_id);
+    if (ah != nullptr)
+      ahs.insert(std::make_pair(key, ah));
+    return ah;
+  }
+
+  usize size() const { return ahs.size(); }
+
+  ~AHCache() {
+    for (auto &e : ahs)
+      ibv_destroy_ah(e.second);
+  }
+};
+
+/*!
+  Up to N UD sends, posted together with one doorbell by flush().
+  Only the last request of a batch is signaled; flush() reaps completed
+  batches, and waits for one if another batch could overflow the send queue.
+
+  Messages up to kMaxInlinSz are inlined, so their buffers can be reused
+  right after add().
+ */
+template <usize N> class UDSendBatch {
+  struct ibv_send_wr wrs[N];
+  struct ibv_sge sges[N];
+  usize cur = 0;
+
+public:
+  bool full() const { return cur == N; }
+
+  usize size() const { return cur; }
+
+  void add(ibv_ah *ah, const u32 &qpn, const u32 &qkey, const void *buf,
+           const u32 &len, const rmem::mr_key_t &lkey) {
+    RDMA_ASSERT(cur < N);
+    sges[cur] = {.addr = reinterpret_cast<u64>(buf), .length = len,
+                 .lkey = lkey};
+
+    auto &wr = wrs[cur];
+    wr.wr_id = 0;
+    wr.opcode = IBV_WR_SEND;
+    wr.num_sge = 1;
+    wr.sg_list = &sges[cur];
+    wr.send_flags = len <= kMaxInlinSz ? IBV_SEND_INLINE : 0;
+    wr.next = nullptr;
+    wr.wr.ud.ah = ah;
+    wr.wr.ud.remote_qpn = qpn;
+    wr.wr.ud.remote_qkey = qkey;
+    if (cur > 0)
+      wrs[cur - 1].next = &wr;
+    cur += 1;
+  }
+
+  Result<int> flush(UD &ud) {
+    if (cur == 0)
+      return ::rdmaio::Ok(0);
+
+    while (ud.out_signaled > 0 && ud.poll_send_comp().first > 0)
+      ;
+    const usize max_batches = ud.my_config.max_send_sz() / N;
+    if (ud.out_signaled > 0 && ud.out_signaled + 1 > max_batches)
+      ud.wait_one_comp();
+
+    wrs[cur - 1].send_flags |= IBV_SEND_SIGNALED;
+    struct ibv_send_wr *bad_sr;
+    auto rc = ibv_post_send(ud.qp, wrs, &bad_sr);
+    if (rc != 0)
+      return ::rdmaio::Err(rc);
+    ud.out_signaled += 1;
+
+    int num = static_cast<int>(cur);
+    cur = 0;
+    return ::rdmaio::Ok(num);
+  }
+};
+
+} // namespace qp
+
+} // namespace rdmaio
@@ -1,25 +1,32 @@
 #pragma once
 
 #include "./rmem/handler.hh"
+#include "./rmem/chunked.hh"
 #include "qps/mod.hh"
 
 #include "./bootstrap/srpc.hh"
 
 #include <atomic>
+#include <thread>
+#include <vector>
 
-#include <pthread.h>
+#include <sys/eventfd.h>
 
 namespace rdmaio {
 
 /*!
   RCtrl is a control path daemon, that handles all RDMA bootstrap to this
-  machine. RCtrl is **thread-safe**.
+  machine. With start_daemon(n > 1) its handlers run on several threads at
+  once: the factories lock per shard, but user state the handlers touch must
+  be thread-safe too, e.g. the AbsRecvAllocator behind a RecvManager's
+  channels.
  */
 class RCtrl {
 
   std::atomic<bool> running;
 
-  pthread_t handler_tid;
+  std::vector<std::thread> handler_threads;
+  int stop_fd = -1; // eventfd waking the handler threads up to stop
 
   /*!
     The two factory which allow user to **register** the QP, MR so that others
@@ -27,6 +34,7 @@ class RCtrl {
    */
 public:
   rmem::MRFactory registered_mrs;
+  rmem::ChunkedMRFactory registered_chunked_mrs;
   qp::QPFactory registered_qps;
   qp::DCFactory registered_dcs;
   Factory<nic_id_t, RNic> opened_nics;
@@ -45,6 +53,10 @@ public:
         proto::CreateRC,
         std::bind(&RCtrl::rc_handler, this, std::placeholders::_1)));
 
+    RDMA_ASSERT(rpc.register_handler(
+        proto::CreateRCBatch,
+        std::bind(&RCtrl::rc_batch_handler, this, std::placeholders::_1)));
+
     RDMA_ASSERT(rpc.register_handler(
         proto::DeleteRC,
         std::bind(&RCtrl::delete_rc, this, std::placeholders::_1)));
@@ -63,38 +75,39 @@ public:
   }
 
   /*!
-    Start the daemon thread for handling RDMA connection requests
+    Start the daemon: nthreads threads handling RDMA connection requests
+    concurrently. They sleep until a request arrives.
    */
-  bool start_daemon() {
+  bool start_daemon(const usize &nthreads = 1) {
+    stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (stop_fd < 0)
+      return false;
     running = true;
-    asm volatile("" ::: "memory");
 
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    return (pthread_create(&handler_tid, &attr, &RCtrl::daemon, this) == 0);
+    for (usize i = 0; i < nthreads; ++i)
+      handler_threads.emplace_back([this] {
+        u64 total_reqs = rpc.run_event_loop(stop_fd);
+        RDMA_LOG(INFO) << "stop with :" << total_reqs << " processed.";
+      });
+    return true;
   }
 
   /*!
-    Stop the daemon thread for handling RDMA connection requests
+    Stop the daemon threads for handling RDMA connection requests
    */
   void stop_daemon() {
     if (running) {
       running = false;
 
-      asm volatile("" ::: "memory");
-      pthread_join(handler_tid, nullptr);
-    }
-  }
-
-  static void *daemon(void *ctx) {
-    RCtrl &ctrl = *((RCtrl *)ctx);
-    u64 total_reqs = 0;
-    while (ctrl.running) {
-      total_reqs += ctrl.rpc.run_one_event_loop();
-      continue;
+      u64 one = 1;
+      if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+        RDMA_LOG(4) << "cannot wake the RCtrl threads: " << strerror(errno);
+      for (auto &t : handler_threads)
+        t.join();
+      handler_threads.clear();
+      close(stop_fd);
+      stop_fd = -1;
     }
-    RDMA_LOG(INFO) << "stop with :" << total_reqs << " processed.";
-    return nullptr; // nothing should return
   }
 
   // handlers of the dameon call
@@ -105,14 +118,23 @@ private:
       auto req_id = o_id.value();
       auto o_mr = registered_mrs.query(req_id.id);
       if (o_mr) {
-        return ::rdmaio::Marshal::dump<proto::MRReply>(
-            {.status = proto::CallbackStatus::Ok,
-             .attr = o_mr.value()->get_reg_attr().value()});
-
-      } else {
-        return ::rdmaio::Marshal::dump<proto::MRReply>(
-            {.status = proto::CallbackStatus::NotFound});
+        proto::MRReply reply = {.status = proto::CallbackStatus::Ok,
+                                .attr = o_mr.value()->get_reg_attr().value()};
+        reply.chunks.attr = reply.attr;
+        reply.chunks.chunk_sz = reply.attr.sz;
+        reply.chunks.num = 1;
+        reply.chunks.keys[0] = reply.attr.key;
+        return ::rdmaio::Marshal::dump<proto::MRReply>(reply);
       }
+      auto o_chunked = registered_chunked_mrs.query(req_id.id);
+      if (o_chunked) {
+        proto::MRReply reply = {.status = proto::CallbackStatus::Ok};
+        reply.chunks = o_chunked.value()->get_chunks();
+        reply.attr = reply.chunks.attr;
+        return ::rdmaio::Marshal::dump<proto::MRReply>(reply);
+      }
+      return ::rdmaio::Marshal::dump<proto::MRReply>(
+          {.status = proto::CallbackStatus::NotFound});
     }
     return ::rdmaio::Marshal::dump<proto::MRReply>(
         {.status = proto::CallbackStatus::WrongArg});
@@ -254,6 +276,57 @@ private:
     return ::rdmaio::Marshal::dump<proto::RCReply>(
         {.status = proto::CallbackStatus::ConnectErr});
   }
+
+  /*!
+    Handling a batch of RC requests: create, register and connect all the
+    QPs of the batch, then return their attributes in one reply. If any of
+    them fails, the ones created so far are deregistered.
+   */
+  ByteBuffer rc_batch_handler(const ByteBuffer &b) {
+    proto::RCBatchReply reply = {.status = proto::CallbackStatus::WrongArg};
+
+    auto req_o = ::rdmaio::Marshal::dedump<proto::RCBatchReq>(b);
+    if (!req_o || req_o.value().num > proto::kMaxBatchRC)
+      return ::rdmaio::Marshal::dump<proto::RCBatchReply>(reply);
+    const auto &req = req_o.value();
+
+    auto nic = opened_nics.query(req.nic_id);
+    if (!nic)
+      return ::rdmaio::Marshal::dump<proto::RCBatchReply>(reply);
+
+    const qp::QPConfig config = req.config;
+    std::vector<std::pair<std::string, u64>> created;
+    for (u32 i = 0; i < req.num; ++i) {
+      auto name = std::string(req.prefix) + std::to_string(req.first + i);
+      if (name.size() > qp::kMaxQPNameLen)
+        break;
+      auto rc = qp::RC::create(nic.value(), config);
+      if (!rc)
+        break;
+      auto key = registered_qps.reg(name, rc.value());
+      if (!key)
+        break;
+      created.push_back(std::make_pair(name, key.value()));
+
+      const qp::QPAttr attr = req.attrs[i];
+      if (rc.value()->connect(attr) != IOCode::Ok) {
+        reply.status = proto::CallbackStatus::ConnectErr;
+        break;
+      }
+      reply.attrs[i] = rc.value()->my_attr();
+      reply.keys[i] = key.value();
+    }
+
+    if (created.size() == req.num &&
+        reply.status == proto::CallbackStatus::WrongArg) {
+      reply.status = proto::CallbackStatus::Ok;
+      reply.num = req.num;
+    } else {
+      for (auto &c : created)
+        registered_qps.dereg(c.first, c.second);
+    }
+    return ::rdmaio::Marshal::dump<proto::RCBatchReply>(reply);
+  }
 };
 
 } // namespace rdmaio
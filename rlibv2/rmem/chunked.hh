@@ -0,0 +1,113 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+
+#include "./handler.hh"
+
+namespace rdmaio {
+
+namespace rmem {
+
+// chunks of one region at most, so that the table fits in a FetchMr reply
+const usize kMaxMRChunks = 256;
+
+/*!
+  The chunk table exchanged between nodes: a region of attr.sz bytes at
+  attr.buf, registered as num equal chunks of chunk_sz bytes (the last one
+  may be shorter). A remote access must not cross a chunk boundary, and uses
+  the rkey of the chunk it falls in.
+ */
+struct __attribute__((packed)) MRChunks {
+  RegAttr attr;
+  u64 chunk_sz = 0;
+  u32 num = 0;
+  mr_key_t keys[kMaxMRChunks];
+
+  mr_key_t key_at(const u64 &off) const { return keys[off / chunk_sz]; }
+};
+
+/*!
+  A region registered as several MRs, in parallel. Pinning a large region in
+  one ibv_reg_mr is serial in the driver; chunks registered from several
+  threads pin concurrently. With IBV_ACCESS_ON_DEMAND in the flags nothing is
+  pinned at registration, pages are faulted in on first access.
+
+  Example:
+  `
+  auto mem = Arc<RMem>(new RMem(32ul << 30, alloc_fn, dealloc_fn));
+  auto chunked = ChunkedRegHandler::create(mem, nic, 16, 16).value();
+  MRChunks table = chunked->get_chunks();
+  `
+ */
+class ChunkedRegHandler {
+  Arc<RMem> rmem;
+  std::vector<Arc<RMem>> pieces;
+  std::vector<Arc<RegHandler>> chunks;
+  u64 chunk_sz = 0;
+
+  ChunkedRegHandler(const Arc<RMem> &mem) : rmem(mem) {}
+
+public:
+  /*!
+    \param num: chunks, rounded so that each is a multiple of align bytes
+    \param nthreads: threads registering them, chunk i by thread i % nthreads
+   */
+  static Option<Arc<ChunkedRegHandler>>
+  create(const Arc<RMem> &mem, const Arc<RNic> &nic, const usize &num,
+         const usize &nthreads, const MemoryFlags &flags = MemoryFlags(),
+         const u64 &align = 2ul << 20) {
+    if (num == 0 || num > kMaxMRChunks || nthreads == 0)
+      return {};
+
+    Arc<ChunkedRegHandler> ret(new ChunkedRegHandler(mem));
+    ret->chunk_sz = ((mem->sz + num - 1) / num + align - 1) / align * align;
+    const usize n = (mem->sz + ret->chunk_sz - 1) / ret->chunk_sz;
+    for (usize i = 0; i < n; ++i) {
+      char *p = static_cast<char *>(mem->raw_ptr) + i * ret->chunk_sz;
+      const u64 sz = std::min(ret->chunk_sz, mem->sz - i * ret->chunk_sz);
+      // views into the region, which is freed by mem itself
+      ret->pieces.push_back(Arc<RMem>(new RMem(
+          sz, [p](u64) { return static_cast<RMem::raw_ptr_t>(p); },
+          [](RMem::raw_ptr_t, u64) {})));
+    }
+
+    ret->chunks.resize(n);
+    std::vector<std::thread> threads;
+    for (usize t = 0; t < std::min(nthreads, n); ++t)
+      threads.emplace_back([&, t] {
+        for (usize i = t; i < n; i += nthreads)
+          ret->chunks[i] = Arc<RegHandler>(
+              new RegHandler(ret->pieces[i], nic, flags));
+      });
+    for (auto &t : threads)
+      t.join();
+
+    for (auto &c : ret->chunks)
+      if (!c->valid())
+        return {};
+    return ret;
+  }
+
+  usize num_chunks() const { return chunks.size(); }
+
+  MRChunks get_chunks() const {
+    MRChunks res = {};
+    res.attr = chunks[0]->get_reg_attr().value();
+    res.attr.buf = reinterpret_cast<uintptr_t>(rmem->raw_ptr);
+    res.attr.sz = rmem->sz;
+    res.chunk_sz = chunk_sz;
+    res.num = static_cast<u32>(chunks.size());
+    for (usize i = 0; i < chunks.size(); ++i)
+      res.keys[i] = chunks[i]->get_reg_attr().value().key;
+    return res;
+  }
+
+  DISABLE_COPY_AND_ASSIGN(ChunkedRegHandler);
+};
+
+using ChunkedMRFactory = Factory<register_id_t, ChunkedRegHandler>;
+
+} // namespace rmem
+
+} // namespace rdmaio
@@ -56,6 +56,16 @@ class MemoryFlags
     protection_flags |= IBV_ACCESS_REMOTE_READ;
     return *this;
   }
+
+  /*
+    On-demand paging: nothing is pinned at registration, the NIC faults the
+    pages in on first access. Needs a NIC with ODP support.
+   */
+  MemoryFlags& add_on_demand()
+  {
+    protection_flags |= IBV_ACCESS_ON_DEMAND;
+    return *this;
+  }
 };
 
 } // end namespace rmem
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -28,27 +29,45 @@ namespace rdmaio {
   opened_nics.dereg(73,key); // delete the nic from the registration
   `
 
+  The entries are spread over kFactoryShards maps by the hash of their name,
+  each with its own lock, so that concurrent handlers of RCtrl rarely
+  contend.
  */
+const usize kFactoryShards = 16;
+
 template <typename K, typename V> class Factory {
-  std::map<K,std::pair<Arc<V>,u64>> store;
-  std::mutex lock;
+  struct Shard {
+    std::map<K,std::pair<Arc<V>,u64>> store;
+    std::mutex lock;
+  };
+  Shard shards[kFactoryShards];
+
+  Shard &shard(const K &k) { return shards[std::hash<K>()(k) % kFactoryShards]; }
 
 public:
   static Arc<V> wrapper_raw_ptr(V *v) {
     return Arc<V>(v, [](auto p) {});
   }
 
-  usize reg_entries() const { return store.size(); }
+  usize reg_entries() {
+    usize num = 0;
+    for (auto &s : shards) {
+      std::lock_guard<std::mutex> guard(s.lock);
+      num += s.store.size();
+    }
+    return num;
+  }
   /*!
     Register a v to the factory,
     if successful, return an authentication key so that user can delete it.
    */
   Option<u64> reg(const K &k, Arc<V> v) {
-    std::lock_guard<std::mutex> guard(lock);
-    if (store.find(k) != store.end())
+    auto &s = shard(k);
+    std::lock_guard<std::mutex> guard(s.lock);
+    if (s.store.find(k) != s.store.end())
       return None;
     auto key = generate_key();
-    store.insert(std::make_pair(k,std::make_pair(v,key)));
+    s.store.insert(std::make_pair(k,std::make_pair(v,key)));
 
     return key;
   }
@@ -57,9 +76,11 @@ public:
     Qeury a registered entry, without authentication.
    */
   Option<Arc<V>> query(const K &k) {
-    std::lock_guard<std::mutex> guard(lock);
-    if (store.find(k) != store.end())
-      return std::get<0>(store[k]);
+    auto &s = shard(k);
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.store.find(k);
+    if (it != s.store.end())
+      return std::get<0>(it->second);
     return {};
   }
 
@@ -71,13 +92,14 @@ public:
   }
 
   Option<Arc<V>> dereg(const K &id, const u64 &k) {
-    std::lock_guard<std::mutex> guard(lock);
-    auto it = store.find(id);
-    if (it != store.end()) {
+    auto &s = shard(id);
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.store.find(id);
+    if (it != s.store.end()) {
       // further check the authentication key
       if (std::get<1>(it->second) == k) {
         auto res = std::get<0>(it->second);
-        store.erase(it);
+        s.store.erase(it);
 
         return res;
       }
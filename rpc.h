@@ -0,0 +1,128 @@
+#if !defined(RPC_H)
+#define RPC_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "rlibv2/lib.hh"
+#include "rlibv2/qps/rc_recv_manager.hh"
+#include "rlibv2/qps/recv_iter.hh"
+#include "rlibv2/qps/srq.hh"
+#include "rlibv2/qps/ud_session.hh"
+#include "common.h"
+
+/*
+ * Two-sided messaging over RC SEND/RECV.
+ *
+ * Client QP i is named RpcQpName + i and connects through the server channel
+ * RpcChannelName + i. On the server a channel either gives the QP its own recv
+ * CQ and RpcRecvDepth posted recvs, drained with a RecvIter, or attaches it
+ * to the shared receive queue and CQ of a polling thread. A request is an
+ * RpcHeader followed by `len` payload bytes; the reply is a bare RpcHeader
+ * echoing the seq.
+ */
+
+static const int RpcMaxQps = 512;               // server channels, client QPs at most
+static const int RpcRecvDepth = 64;             // posted recvs per QP
+static const int RpcSrqDepth = 1024;            // shared recvs per server thread
+static const uint32_t RpcMaxPayload = 16384;
+static const char *RpcQpName = "client-rpc";
+static const char *RpcChannelName = "rpc-ch";
+
+struct RpcHeader {
+    uint64_t seq;
+    uint32_t len;               // payload bytes after the header
+    uint32_t pad;
+};
+
+static const uint32_t RpcMsgSize = sizeof(RpcHeader) + RpcMaxPayload;
+
+/*
+ * RDMA write with immediate. Client QP k writes sequentially into area k of
+ * the server's first PM region, wrapping before a write would cross its end;
+ * the immediate is (k << ImmOffBits) | (offset in the area in cache lines),
+ * and the length is the byte_len of the server's completion. Each write
+ * consumes a recv on the channel, so the server persists exactly the range
+ * the immediate names, whatever it saw of earlier runs.
+ */
+static const uint64_t ImmAreaSize = ServerMemSize / RpcMaxQps;
+static const uint32_t ImmMaxLen = 0xffff * 64;
+static const int ImmOffBits = 20;
+
+static_assert(ImmAreaSize / 64 <= 1ul << ImmOffBits && RpcMaxQps <= 1 << (32 - ImmOffBits),
+              "area and offset must fit an immediate");
+
+static inline uint32_t imm_encode(uint32_t area, uint64_t off)
+{
+    return area << ImmOffBits | (uint32_t)(off / 64);
+}
+
+static inline uint32_t imm_area(uint32_t imm) { return imm >> ImmOffBits; }
+static inline uint64_t imm_off(uint32_t imm) { return (uint64_t)(imm & ((1u << ImmOffBits) - 1)) * 64; }
+
+/*
+ * The same requests and replies over UD: one UD QP per server thread, named
+ * UdServerName + t, serves any number of clients. A message is at most
+ * UdMaxMsg (UD::kMaxMsgSz) bytes, and every recv buffer starts with the
+ * kGRHSz bytes of the GRH. Server thread t persists payloads into a log in
+ * area t of the first PM region.
+ */
+static const char *UdServerName = "server-ud";
+static const int UdMaxThreads = 16;
+static const int UdRecvDepth = 64;              // posted recvs and send batch per UD QP
+static const uint32_t UdMaxMsg = 4000;
+static const uint32_t UdMaxPayload = UdMaxMsg - sizeof(RpcHeader);
+static const uint64_t UdAreaSize = ServerMemSize / UdMaxThreads;
+
+using RpcEntries = rdmaio::qp::RecvEntries<RpcRecvDepth>;
+using RpcIter = rdmaio::qp::RecvIter<rdmaio::qp::RC, RpcRecvDepth>;
+using RpcSRQ = rdmaio::qp::SRQ<RpcSrqDepth>;
+using UdEntries = rdmaio::qp::RecvEntries<UdRecvDepth>;
+using UdIter = rdmaio::qp::RecvIter<rdmaio::qp::UD, UdRecvDepth>;
+using UdBatch = rdmaio::qp::UDSendBatch<UdRecvDepth>;
+
+// bytes a recv buffer of sz takes in a BumpRecvAllocator region
+static inline uint64_t recv_slot(uint64_t sz) { return (sz + 63) & ~63ul; }
+
+/*
+ * Hands out consecutive 64B-aligned recv buffers from one registered region.
+ * Buffers are never freed; size the region for all QPs up front with
+ * recv_slot(). Thread-safe: RCtrl handler threads allocate concurrently.
+ */
+class BumpRecvAllocator : public rdmaio::qp::AbsRecvAllocator {
+    rdmaio::Arc<rdmaio::rmem::RegHandler> mr;
+    rdmaio::rmem::mr_key_t lkey;
+    std::atomic<char *> cur;
+    char *end;
+
+public:
+    explicit BumpRecvAllocator(rdmaio::Arc<rdmaio::rmem::RegHandler> mr) : mr(mr)
+    {
+        auto attr = mr->get_reg_attr().value();
+        lkey = attr.lkey;
+        cur = (char *)attr.buf;
+        end = (char *)attr.buf + attr.sz;
+    }
+
+    rdmaio::Option<std::pair<rdmaio::rmem::RMem::raw_ptr_t, rdmaio::rmem::mr_key_t>>
+    alloc_one(const rdmaio::usize &sz) override
+    {
+        char *p = cur.fetch_add(recv_slot(sz), std::memory_order_relaxed);
+        if (p + sz > end)
+            return {};
+        return std::make_pair((rdmaio::rmem::RMem::raw_ptr_t)p, lkey);
+    }
+
+    rdmaio::Option<std::pair<rdmaio::rmem::RMem::raw_ptr_t, rdmaio::rmem::RegAttr>>
+    alloc_one_for_remote(const rdmaio::usize &sz) override
+    {
+        auto attr = mr->get_reg_attr().value();
+        auto p = alloc_one(sz);
+        if (!p)
+            return {};
+        return std::make_pair(std::get<0>(p.value()), attr);
+    }
+};
+
+#endif // RPC_H
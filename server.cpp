@@ -5,55 +5,481 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include "rlibv2/lib.hh"
 #include "common.h"
+#include "bench.h"
+#include "persist.h"
+#include "pmdev.h"
+#include "rpc.h"
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
+using namespace rdmaio::qp;
 
 static const size_t PageSize = 2ul << 20;
-static char const *PmDev = "/dev/dax0.0";
+static char const *PmDev = "/dev/dax0.0";     // comma-separated, one MR each
+
+static OutputFormat Format = FmtText;
+static int ZeroThreads = 0;     // 0: leave the region as is
+static int RpcThreads = 0;      // 0: one-sided only, no SEND/RECV channels
+static int RpcQps = 16;         // client QPs to prepare channels for
+static bool RpcSrq = false;     // one SRQ per polling thread instead of per-QP recvs
+static int UdThreads = 0;       // UD datagram servers, one UD QP each
+static int RegChunks = 1;       // MRs per device, registered by as many threads
+static bool RegOdp = false;     // on-demand paging, nothing pinned up front
+static int CtrlThreads = 4;     // threads handling connection requests
+
+// replies are signaled every RpcSignalEvery; idle pollers look for new QPs
+// every RpcDiscoverEvery rounds
+static const u64 RpcSignalEvery = 16;
+static const u64 RpcDiscoverEvery = 1ul << 20;
+
+void parse_inargs(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "f:z:d:r:Q:qu:c:ot:")) != -1) {
+        switch (opt) {
+        case 'f':
+            Format = parse_format(optarg);
+            break;
+        case 'z':
+            ZeroThreads = std::atoi(optarg);
+            break;
+        case 'd':
+            PmDev = optarg;
+            break;
+        case 'r':
+            RpcThreads = std::atoi(optarg);
+            break;
+        case 'Q':
+            RpcQps = std::atoi(optarg);
+            break;
+        case 'q':
+            RpcSrq = true;
+            break;
+        case 'u':
+            UdThreads = std::atoi(optarg);
+            break;
+        case 'c':
+            RegChunks = std::atoi(optarg);
+            break;
+        case 'o':
+            RegOdp = true;
+            break;
+        case 't':
+            CtrlThreads = std::atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-f text|csv|json] [-z <NThreads>] [-d dev[,dev...]] [-r <NThreads> [-Q <nqps>] [-q]] [-u <NThreads>] [-c <nchunks>] [-o] [-t <NThreads>]\n", argv[0]);
+            fprintf(stderr, "  -z  zero the registered regions with NThreads before serving\n");
+            fprintf(stderr, "  -d  PM devices to register, one MR each, ids %d.. (default %s)\n", RegMemName, PmDev);
+            fprintf(stderr, "  -r  serve `client -m rpc|imm` with NThreads polling threads, persisting to the first device\n");
+            fprintf(stderr, "  -Q  rpc: client QPs to accept (default %d, at most %d)\n", RpcQps, RpcMaxQps);
+            fprintf(stderr, "  -q  rpc: one shared receive queue of %d recvs per polling thread,\n", RpcSrqDepth);
+            fprintf(stderr, "      instead of %d recvs per QP\n", RpcRecvDepth);
+            fprintf(stderr, "  -u  serve `client -m ud` with NThreads UD QPs, one thread each\n");
+            fprintf(stderr, "  -c  register each device as nchunks MRs, in parallel threads (default 1, at most %d)\n",
+                    (int)kMaxMRChunks);
+            fprintf(stderr, "  -o  register with on-demand paging (IBV_ACCESS_ON_DEMAND), if the NIC supports it\n");
+            fprintf(stderr, "  -t  threads handling connection requests (default %d)\n", CtrlThreads);
+            exit(-1);
+        }
+    }
+    if (ZeroThreads < 0) {
+        fprintf(stderr, "-z needs a positive thread count\n");
+        exit(-1);
+    }
+    if (RpcQps < 1 || RpcQps > RpcMaxQps || RpcThreads < 0 || RpcThreads > RpcQps) {
+        fprintf(stderr, "-Q must be in [1, %d], -r in [0, -Q]\n", RpcMaxQps);
+        exit(-1);
+    }
+    if (CtrlThreads < 1) {
+        fprintf(stderr, "-t needs a positive thread count\n");
+        exit(-1);
+    }
+    if (RegChunks < 1 || RegChunks > (int)kMaxMRChunks) {
+        fprintf(stderr, "-c must be in [1, %d]\n", (int)kMaxMRChunks);
+        exit(-1);
+    }
+    if (UdThreads < 0 || UdThreads > UdMaxThreads) {
+        fprintf(stderr, "-u must be in [0, %d]\n", UdMaxThreads);
+        exit(-1);
+    }
+}
+
+/*
+ * Zero `len` bytes of PM with non-temporal stores, one page-aligned slice per
+ * thread.
+ */
+void zero_fill(char *buf, u64 len, int nthreads)
+{
+    u64 slice = ((len / nthreads - 1) / PageSize + 1) * PageSize;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; ++i) {
+        u64 begin = std::min(len, slice * i), end = std::min(len, slice * (i + 1));
+        threads.emplace_back([=] {
+            bind_core(i);
+            memset_movnt_avx512f_clwb(buf + begin, 0, end - begin);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+struct RpcConn {
+    Arc<RC> qp;
+    Arc<RpcEntries> entries;    // per-QP recvs, null on an SRQ
+    char *slice;                // of the PM region, for this QP's payloads
+    u64 replies = 0;
+};
+
+/*
+ * Requests served and payload bytes persisted per serving thread: rpc
+ * polling threads first, then the UD threads. Only the owner writes its
+ * entry; the main thread reads them for the interval and summary records.
+ */
+struct alignas(64) ServeStats {
+    u64 ops = 0;
+    u64 bytes = 0;
+};
+ServeStats served[RpcMaxQps + UdMaxThreads];
+std::atomic<u64> serve_active_us{0};    // summed length of the intervals with traffic
+
+/*
+ * Progress of a client writing with immediates into its area of the region.
+ * Only the polling thread owning the area updates it.
+ */
+struct ImmProgress {
+    u64 cursor = 0;             // end of the latest write
+    u64 writes = 0;
+    u64 bytes = 0;
+};
+ImmProgress imm_progress[RpcMaxQps];
+
+/*
+ * A write with immediate of len bytes landed: persist the range the
+ * immediate names. Returns the bytes persisted.
+ */
+static u64 imm_persist(u32 imm, u32 len, char *pm)
+{
+    const u32 area = imm_area(imm);
+    const u64 off = imm_off(imm);
+    if (area >= RpcMaxQps || off + len > ImmAreaSize)
+        return 0;
+    ImmProgress &p = imm_progress[area];
+    flush_clwb_nolog(pm + area * ImmAreaSize + off, len);
+    _mm_sfence();
+    p.cursor = off + len;
+    p.writes++;
+    p.bytes += len;
+    return len;
+}
+
+/*
+ * Persist one request's payload and reply to it inline. Send completions are
+ * reaped before each signaled reply, so at most 2 * RpcSignalEvery replies
+ * occupy the send queue. Returns the bytes persisted.
+ */
+static u64 rpc_serve(RpcConn &c, const RpcHeader *h, u64 units)
+{
+    const u32 len = std::min(h->len, RpcMaxPayload);
+    memmove_movnt_avx512f_clwb(c.slice + (h->seq % units) * RpcMaxPayload, (char *)(h + 1), len);
+
+    const bool signaled = c.replies % RpcSignalEvery == 0;
+    if (signaled)
+        while (c.qp->poll_send_comp().first > 0);
+    RpcHeader reply = {h->seq, 0, 0};
+    c.qp->send_normal(
+        {
+            .op = IBV_WR_SEND,
+            .flags = IBV_SEND_INLINE | (signaled ? IBV_SEND_SIGNALED : 0),
+            .len = sizeof(reply),
+            .wr_id = 0
+        },
+        {
+            .local_addr = reinterpret_cast<RMem::raw_ptr_t>(&reply),
+            .remote_addr = 0,
+            .imm_data = 0
+        },
+        RegAttr(), RegAttr()
+    );
+    c.replies++;
+    return len;
+}
+
+/*
+ * RPC polling thread `id` serves client QPs id, id + RpcThreads, ..., each
+ * with a 1/RpcQps slice of `pm`. Without an SRQ every QP has its own recv CQ
+ * and is drained with a RecvIter; with one, all of the thread's QPs share
+ * `srq` and `srq_cq`, and completions are mapped back by QP number. Writes
+ * with immediate are persisted by area and not replied to.
+ */
+void rpc_server(int id, RCtrl *ctrl, RecvManager<RpcRecvDepth> *mgr, RpcSRQ *srq, ibv_cq *srq_cq, char *pm)
+{
+    std::vector<RpcConn> conns(RpcQps);
+    std::unordered_map<u32, RpcConn *> by_qpn;
+    const u64 units = ServerMemSize / RpcQps / RpcMaxPayload;
+    ibv_wc wcs[RpcRecvDepth];
+
+    // the QP is registered before its entries, and both before the client
+    // is told it may send
+    auto discover = [&] {
+        for (int k = id; k < RpcQps; k += RpcThreads) {
+            RpcConn &c = conns[k];
+            if (c.qp)
+                continue;
+            auto entries = mgr->reg_recv_entries.query(RpcQpName + std::to_string(k));
+            auto qp = ctrl->registered_qps.query(RpcQpName + std::to_string(k));
+            if (!qp || (srq == nullptr && !entries))
+                continue;
+            c.qp = std::dynamic_pointer_cast<RC>(qp.value());
+            if (entries)
+                c.entries = entries.value();
+            c.slice = pm + k * units * RpcMaxPayload;
+            by_qpn[c.qp->qp->qp_num] = &c;
+        }
+    };
+
+    ServeStats &st = served[id];
+    bind_core(id);
+    for (u64 round = 0;; ++round) {
+        if (round % RpcDiscoverEvery == 0)
+            discover();
+
+        if (srq != nullptr) {
+            int n = ibv_poll_cq(srq_cq, RpcRecvDepth, wcs);
+            for (int i = 0; i < n; ++i) {
+                auto it = by_qpn.find(wcs[i].qp_num);
+                if (it == by_qpn.end()) {
+                    discover();
+                    it = by_qpn.find(wcs[i].qp_num);
+                }
+                if (wcs[i].status == IBV_WC_SUCCESS) {
+                    if (wcs[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+                        st.bytes += imm_persist(wcs[i].imm_data, wcs[i].byte_len, pm);
+                        st.ops++;
+                    } else if (it != by_qpn.end()) {
+                        st.bytes += rpc_serve(*it->second, (RpcHeader *)wcs[i].wr_id, units);
+                        st.ops++;
+                    }
+                }
+                srq->release(wcs[i].wr_id);
+            }
+            srq->refill();
+            continue;
+        }
+
+        for (int k = id; k < RpcQps; k += RpcThreads) {
+            RpcConn &c = conns[k];
+            if (!c.qp)
+                continue;
+            for (RpcIter it(c.qp, c.entries); it.has_msgs(); it.next()) {
+                if (it.cur_wc().opcode == IBV_WC_RECV_RDMA_WITH_IMM)
+                    st.bytes += imm_persist(it.cur_wc().imm_data, it.cur_wc().byte_len, pm);
+                else
+                    st.bytes += rpc_serve(c, (RpcHeader *)std::get<1>(it.cur_msg().value()), units);
+                st.ops++;
+            }
+        }
+    }
+}
+
+/*
+ * UD server `id`: persist the payload of every request to the thread's log
+ * and answer each recv batch with one batch of inline replies. Clients are
+ * only known by the address handles cached for their replies.
+ */
+void ud_server(int id, Arc<UD> ud, Arc<UdEntries> entries, char *pm)
+{
+    AHCache ahs(ud);
+    UdBatch replies;
+    RpcHeader reply[UdRecvDepth];
+    char *log = pm + id * UdAreaSize;
+    u64 cursor = 0;
+    ServeStats &st = served[RpcThreads + id];
+
+    bind_core(RpcThreads + id);
+    while (true) {
+        int k = 0;
+        for (UdIter it(ud, entries); it.has_msgs(); it.next()) {
+            const ibv_wc &wc = it.cur_wc();
+            char *buf = (char *)std::get<1>(it.cur_msg().value());
+            if (wc.status != IBV_WC_SUCCESS)
+                continue;
+            RpcHeader *h = (RpcHeader *)(buf + kGRHSz);
+            const u32 len = std::min(h->len, UdMaxPayload);
+            if (cursor + len > UdAreaSize)
+                cursor = 0;
+            memmove_movnt_avx512f_clwb(log + cursor, (char *)(h + 1), len);
+            cursor += (len + 63) & ~63ul;
+            st.ops++;
+            st.bytes += len;
+
+            ibv_ah *ah = ahs.query(wc, (ibv_grh *)buf);
+            if (ah == nullptr)
+                continue;
+            reply[k] = {h->seq, 0, 0};
+            replies.add(ah, wc.src_qp, kDefaultQKey, &reply[k], sizeof(RpcHeader), 0);
+            k++;
+        }
+        replies.flush(*ud);
+    }
+}
 
 int main(int argc, char **argv)
 {
+    parse_inargs(argc, argv);
+
     RCtrl ctrl(PORT);
 
     auto nic = RNic::create(RNicInfo::query_dev_names().at(UseNixIdx)).value();
     ctrl.opened_nics.reg(RegNicName, nic);
 
-    int fd = -1;
-    auto pm_alloc_fn = [&fd](u64 size) -> RMem::raw_ptr_t { 
-        int fd = open(PmDev, O_RDWR);
-        if (fd < 0) {
-            fprintf(stderr, "cannot open %s: %s\n", PmDev, strerror(errno));
+    // RegChunks MRs per device, the chunk table named RegMemName + i
+    MemoryFlags reg_flags;
+    if (RegOdp)
+        reg_flags.add_on_demand();
+    auto devs = split_list(PmDev);
+    std::vector<u64 *> reg_mems;
+    auto reg_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < devs.size(); ++i) {
+        std::string path = devs[i];
+        auto pm_alloc_fn = [path](u64 size) -> RMem::raw_ptr_t {
+            u64 sz = ((size - 1) / PageSize + 1) * PageSize;
+            return reinterpret_cast<RMem::raw_ptr_t>(map_pm(path.c_str(), sz));
+        };
+        auto pm_dealloc_fn = [](RMem::raw_ptr_t ptr, u64 size) {
+            if (ptr != 0)
+                munmap((void *)ptr, size);
+        };
+        auto mem = Arc<RMem>(new RMem(ServerMemSize, pm_alloc_fn, pm_dealloc_fn));
+        if (!ctrl.registered_chunked_mrs.create_then_reg(RegMemName + i, mem, nic, (usize)RegChunks,
+                                                         (usize)RegChunks, reg_flags, PageSize)) {
+            fprintf(stderr, "cannot register %s: %s\n", path.c_str(), strerror(errno));
             exit(-1);
         }
-        void *buf = nullptr;
-        u64 sz = ((size - 1) / PageSize + 1) * PageSize;
-        
-        buf = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (buf == (void *)-1) {
-            fprintf(stderr, "cannot mmap: %s\n", strerror(errno));
-            exit(-1);
+        reg_mems.push_back((u64 *)mem->raw_ptr);
+    }
+    auto reg_end = std::chrono::steady_clock::now();
+
+    double zero_secs = 0;
+    if (ZeroThreads > 0) {
+        auto zero_start = std::chrono::steady_clock::now();
+        for (u64 *reg_mem : reg_mems)
+            zero_fill((char *)reg_mem, ServerMemSize, ZeroThreads);
+        zero_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - zero_start).count();
+    }
+
+    // SEND/RECV channels, recv buffers in DRAM. Without an SRQ each client
+    // QP gets a recv CQ and RpcRecvDepth buffers; with one, the channels of a
+    // polling thread share its CQ and RpcSrqDepth buffers.
+    Arc<RecvManager<RpcRecvDepth>> rpc_mgr;
+    std::vector<Arc<RpcSRQ>> srqs;
+    u64 recv_bytes = 0;
+    if (RpcThreads > 0) {
+        rpc_mgr = Arc<RecvManager<RpcRecvDepth>>(new RecvManager<RpcRecvDepth>(ctrl));
+        recv_bytes = RpcSrq ? (u64)RpcThreads * RpcSrqDepth * recv_slot(RpcMsgSize) : (u64)RpcQps * RpcRecvDepth * recv_slot(RpcMsgSize);
+        auto recv_mem = Arc<RMem>(new RMem(recv_bytes));
+        auto recv_mr = RegHandler::create(recv_mem, nic).value();
+        Arc<AbsRecvAllocator> alloc(new BumpRecvAllocator(recv_mr));
+
+        auto create_cq = [&](int depth) {
+            auto cq = Impl::create_cq(nic, depth);
+            if (cq != IOCode::Ok) {
+                fprintf(stderr, "cannot create recv CQ: %s\n", std::get<1>(cq.desc).c_str());
+                exit(-1);
+            }
+            return std::get<0>(cq.desc);
+        };
+        std::vector<ibv_cq *> srq_cqs;
+        for (int t = 0; RpcSrq && t < RpcThreads; ++t) {
+            auto srq = RpcSRQ::create(nic, alloc, RpcMsgSize);
+            if (!srq) {
+                fprintf(stderr, "cannot create SRQ\n");
+                exit(-1);
+            }
+            srqs.push_back(srq.value());
+            srq_cqs.push_back(create_cq(RpcSrqDepth));
         }
-        return reinterpret_cast<RMem::raw_ptr_t>(buf);
-    };
-    auto pm_dealloc_fn = [&fd](RMem::raw_ptr_t ptr, u64 size) {
-        if (ptr != 0)
-            munmap((void *)ptr, size);
-        close(fd);
-    };
-    ctrl.registered_mrs.create_then_reg(
-        RegMemName, Arc<RMem>(new RMem(ServerMemSize, pm_alloc_fn, pm_dealloc_fn)),
-        ctrl.opened_nics.query(RegNicName).value()
-    );
+        for (int i = 0; i < RpcQps; ++i) {
+            auto common = RpcSrq ? RecvCommon::create(srq_cqs[i % RpcThreads], alloc, srqs[i % RpcThreads]->srq)
+                                 : RecvCommon::create(create_cq(RpcRecvDepth), alloc);
+            rpc_mgr->reg_recv_cqs.reg(RpcChannelName + std::to_string(i), common.value());
+        }
+        for (int t = 0; t < RpcThreads; ++t)
+            std::thread(rpc_server, t, &ctrl, rpc_mgr.get(), RpcSrq ? srqs[t].get() : nullptr,
+                        RpcSrq ? srq_cqs[t] : nullptr, (char *)reg_mems[0]).detach();
+    }
 
-    u64 *reg_mem = (u64 *)(ctrl.registered_mrs.query(RegMemName).value()->get_reg_attr().value().buf);
-    // memset(reg_mem, 0, MemSize);
-    
-    ctrl.start_daemon();
+    // UD servers, registered as QPs so that clients can fetch their attrs
+    if (UdThreads > 0) {
+        auto recv_mem = Arc<RMem>(new RMem((u64)UdThreads * UdRecvDepth * recv_slot(kGRHSz + UdMaxMsg)));
+        Arc<AbsRecvAllocator> alloc(new BumpRecvAllocator(RegHandler::create(recv_mem, nic).value()));
+        for (int t = 0; t < UdThreads; ++t) {
+            auto ud = UD::create(nic, QPConfig()).value();
+            auto entries = RecvEntriesFactoryv2<UdRecvDepth>::create(alloc, kGRHSz + UdMaxMsg);
+            if (ud->post_recvs(*entries, UdRecvDepth) != IOCode::Ok) {
+                fprintf(stderr, "cannot post recvs on UD QP %d\n", t);
+                exit(-1);
+            }
+            ctrl.registered_qps.reg(UdServerName + std::to_string(t), ud);
+            std::thread(ud_server, t, ud, entries, (char *)reg_mems[0]).detach();
+        }
+    }
+
+    if (!ctrl.start_daemon(CtrlThreads)) {
+        fprintf(stderr, "cannot start the connection daemon: %s\n", strerror(errno));
+        exit(-1);
+    }
     printf("server started.\n");
 
+    Record r;
+    r.add("type", "server").add("bench", "server").add("backend", PmDev)
+     .add("devices", (u64)devs.size()).add("mem_bytes", (u64)ServerMemSize * devs.size())
+     .add("reg_secs", std::chrono::duration<double>(reg_end - reg_start).count())
+     .add("reg_chunks", RegChunks).add("ctrl_threads", CtrlThreads).add("reg_odp", RegOdp ? "yes" : "no")
+     .add("zero_threads", ZeroThreads).add("zero_secs", zero_secs).add("rpc_threads", RpcThreads)
+     .add("rpc_qps", RpcQps).add("rpc_recv", RpcSrq ? "srq" : "rq").add("rpc_recv_bytes", recv_bytes)
+     .add("ud_threads", UdThreads);
+    add_run_meta(r);
+    r.print(Format);
+
+    // server-side throughput: an interval record for every second with
+    // traffic, and a summary over those seconds at exit
+    const int nserve = RpcThreads + UdThreads;
+    RunInfo info = {"server", PmDev, "serve", nserve, 0};
+    auto totals = [nserve] {
+        ServeStats t;
+        for (int i = 0; i < nserve; ++i) {
+            t.ops += served[i].ops;
+            t.bytes += served[i].bytes;
+        }
+        return t;
+    };
+    if (nserve > 0)
+        std::thread([info, totals] {
+            ServeStats last;
+            auto last_time = std::chrono::steady_clock::now();
+            int seq = 0;
+            while (true) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                auto now = std::chrono::steady_clock::now();
+                double secs = std::chrono::duration<double>(now - last_time).count();
+                ServeStats t = totals();
+                if (t.ops != last.ops) {
+                    report_interval(info, Format, seq++, secs, t.ops - last.ops, t.bytes - last.bytes);
+                    serve_active_us += (u64)(secs * 1e6);
+                }
+                last = t;
+                last_time = now;
+            }
+        }).detach();
+
     while (true) {
         printf("press any key to terminate ...\n");
         getchar();
@@ -68,5 +494,27 @@ int main(int argc, char **argv)
         printf("\n");
     } 
 
+    if (nserve > 0) {
+        ServeStats t = totals();
+        u64 rpc_ops = 0, ud_ops = 0;
+        for (int i = 0; i < nserve; ++i)
+            (i < RpcThreads ? rpc_ops : ud_ops) += served[i].ops;
+        double secs = serve_active_us.load() / 1e6;
+        Record summary = summary_record(info, secs > 0 ? secs : 1, t.ops, t.bytes, LatHist());
+        summary.add("rpc_ops", rpc_ops).add("ud_ops", ud_ops);
+        summary.print(Format);
+    }
+
+    // per-client progress of writes with immediate
+    for (int k = 0; k < RpcQps; ++k) {
+        if (imm_progress[k].writes == 0)
+            continue;
+        Record p;
+        p.add("type", "imm-progress").add("bench", "server").add("qp", k)
+         .add("writes", imm_progress[k].writes).add("bytes", imm_progress[k].bytes)
+         .add("cursor", imm_progress[k].cursor);
+        p.print(Format);
+    }
+
     return 0;
 }
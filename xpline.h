@@ -0,0 +1,88 @@
+#if !defined(XPLINE_H)
+#define XPLINE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include "persist.h"
+
+/*
+ * Write-combining staging for small appends.
+ *
+ * Optane writes media in 256B XPLines (NVM_BLOCK_SIZE), so a persist smaller
+ * than that makes the DIMM read-modify-write the line. XPLineBuffer gathers
+ * appends to a PM log in a DRAM copy of the current XPLine, and writes the
+ * line out as a whole with one memmove_movnt4x64b when it fills up or on
+ * flush(). The staging line is zeroed whenever a new line starts, so a
+ * partial flush puts zeros after the tail, never bytes of an older line.
+ * Not thread-safe: use one buffer per thread and log.
+ */
+struct XPLineBuffer {
+    alignas(64) char line[NVM_BLOCK_SIZE];
+    char *base = nullptr;       // log start, NVM_BLOCK_SIZE aligned
+    size_t cap = 0;             // log size, a multiple of NVM_BLOCK_SIZE
+    size_t tail = 0;            // next append offset in the log
+    size_t flushed = 0;         // bytes of the current line already on PM
+
+    void init(char *log, size_t size)
+    {
+        base = log;
+        cap = size / NVM_BLOCK_SIZE * NVM_BLOCK_SIZE;
+        tail = 0;
+        flushed = 0;
+        memset(line, 0, sizeof(line));
+    }
+
+    /*
+     * Append `len` bytes; returns the log offset they were written at. The
+     * log wraps around at the end. Data is durable after the line holding it
+     * fills up or after flush().
+     */
+    size_t append(const void *data, size_t len)
+    {
+        const char *p = (const char *)data;
+        size_t at = tail;
+        while (len > 0) {
+            size_t off = tail % NVM_BLOCK_SIZE;
+            size_t n = std::min(len, (size_t)NVM_BLOCK_SIZE - off);
+            memcpy(line + off, p, n);
+            p += n;
+            len -= n;
+            tail += n;
+            if (tail % NVM_BLOCK_SIZE == 0) {
+                write_line();
+                _mm_sfence();
+                if (tail == cap)
+                    tail = 0;
+                flushed = 0;
+                memset(line, 0, sizeof(line));
+            }
+        }
+        return at;
+    }
+
+    /*
+     * Persist a partially filled line. The whole 256B line is written, so
+     * the DIMM still sees a full XPLine write; past the tail it is zero.
+     */
+    void flush()
+    {
+        size_t off = tail % NVM_BLOCK_SIZE;
+        if (off == flushed)
+            return;
+        write_line();
+        _mm_sfence();
+        flushed = off;
+    }
+
+private:
+    void write_line()
+    {
+        size_t line_start = (tail - 1) / NVM_BLOCK_SIZE * NVM_BLOCK_SIZE;
+        memmove_movnt4x64b(base + line_start, line);
+        avx_zeroupper();
+    }
+};
+
+#endif // XPLINE_H